@@ -7,16 +7,40 @@ uniform mat4 view;
 uniform mat4 projection;
 uniform sampler2D heightMap;
 uniform sampler2D normalMap;
+// value = texel * scale + bias, see Ocean::setDecodeUniforms
+uniform vec3 heightScale;
+uniform vec3 heightBias;
+uniform float normalScale;
+uniform float normalBias;
+// The normal map only stores x and z
+uniform bool normalFromXZ;
+// The maps of the next simulated frame, blended in by frameBlend
+uniform sampler2D nextHeightMap;
+uniform sampler2D nextNormalMap;
+uniform vec3 nextHeightScale;
+uniform vec3 nextHeightBias;
+uniform float frameBlend;
 
 out vec3 vNormal;
 out vec4 vFragPosition;
 
+vec3 decodeNormal(sampler2D map, vec2 texCoord)
+{
+    vec3 n = vec3(texture(map, texCoord)) * normalScale + normalBias;
+    if (normalFromXZ)
+        return vec3(n.x, sqrt(max(0.0f, 1.0f - dot(n.xy, n.xy))), n.y);
+    return n;
+}
+
 void main() {
-    vec3 height = (vec3(texture(heightMap, aPos.xz / 64.0f)) - vec3(0.5f)) * 5.0f;
+    vec3 height = mix(vec3(texture(heightMap, aPos.xz / 64.0f)) * heightScale + heightBias,
+                      vec3(texture(nextHeightMap, aPos.xz / 64.0f)) * nextHeightScale + nextHeightBias,
+                      frameBlend);
     vec3 pos = aPos + height;
     gl_Position = model * vec4(pos, 1.0);
     vFragPosition = gl_Position;
 
-    vec3 n = (vec3(texture(normalMap, aPos.xz / 64.0f)) - vec3(0.5f)) * 2.0f;
+    vec3 n = mix(decodeNormal(normalMap, aPos.xz / 64.0f),
+                 decodeNormal(nextNormalMap, aPos.xz / 64.0f), frameBlend);
 	vNormal = mat3(transpose(inverse(model))) * n;
 }
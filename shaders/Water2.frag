@@ -17,12 +17,28 @@ uniform vec3 ambient;
 uniform vec3 specular;
 
 uniform sampler2D normalMap;
+// See Ocean::setDecodeUniforms
+uniform float normalScale;
+uniform float normalBias;
+uniform bool normalFromXZ;
+// The normal map of the next simulated frame, blended in by frameBlend
+uniform sampler2D nextNormalMap;
+uniform float frameBlend;
 uniform sampler2D heightMap;
 uniform samplerCube skybox;
 
+vec3 decodeNormal(sampler2D map, vec2 texCoord)
+{
+    vec3 n = vec3(texture(map, texCoord)) * normalScale + normalBias;
+    if (normalFromXZ)
+        return vec3(n.x, sqrt(max(0.0f, 1.0f - dot(n.xy, n.xy))), n.y);
+    return n;
+}
+
 void main()
 {
-    vec3 n = normalize(2.0f * vec3(texture(normalMap, fs_in.texCoord)) - 1.0f);
+    vec3 n = normalize(mix(decodeNormal(normalMap, fs_in.texCoord),
+                           decodeNormal(nextNormalMap, fs_in.texCoord), frameBlend));
     vec3 eyeVec = normalize(viewPos - vec3(fs_in.fragPos));
     vec3 halfwayDir = normalize(lightDir + eyeVec);
     vec3 reflectVec = 2 * dot(eyeVec, n) * n - eyeVec;
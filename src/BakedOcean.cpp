@@ -0,0 +1,530 @@
+//
+// Baked ocean animations
+//
+
+#include "BakedOcean.h"
+#include "Half.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(BakedOceanHeader) == 112, "BakedOceanHeader must not depend on the compiler");
+static_assert(sizeof(BakedFrameEntry) == 16, "BakedFrameEntry must not depend on the compiler");
+
+namespace {
+
+const char Magic[8] = {'O', 'C', 'E', 'A', 'N', 'B', 'A', 'K'};
+const uint32_t Version = 1;
+
+// LZ4 block format: sequences of a token, literals and a match, where the
+// token holds the literal count and the match length minus 4, four bits
+// each, with 15 meaning that more length bytes follow
+const int MinMatch = 4;
+// The last match must start this many bytes before the end and the last
+// bytes are always literals
+const int MatchStartLimit = 12;
+const int LastLiterals = 5;
+const int HashBits = 14;
+
+inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+void writeLength(std::vector<uint8_t> &out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        out.push_back(255);
+    out.push_back((uint8_t)length);
+}
+
+void writeSequence(std::vector<uint8_t> &out, const uint8_t *literals, size_t literalCount,
+                   size_t offset, size_t matchLength)
+{
+    size_t matchCode = matchLength ? matchLength - MinMatch : 0;
+    out.push_back((uint8_t)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15)));
+    if (literalCount >= 15)
+        writeLength(out, literalCount - 15);
+    out.insert(out.end(), literals, literals + literalCount);
+    if (!matchLength)
+        return;
+    out.push_back((uint8_t)(offset & 0xff));
+    out.push_back((uint8_t)(offset >> 8));
+    if (matchCode >= 15)
+        writeLength(out, matchCode - 15);
+}
+
+// Greedy compressor with a hash table of the last position of every four
+// byte sequence
+void compressBlock(const uint8_t *src, size_t size, std::vector<uint8_t> &out)
+{
+    out.clear();
+    std::vector<int64_t> table((size_t)1 << HashBits, -1);
+    size_t anchor = 0, i = 0;
+    while (size >= (size_t)MatchStartLimit && i < size - MatchStartLimit) {
+        uint32_t sequence = read32(src + i);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HashBits);
+        int64_t reference = table[hash];
+        table[hash] = (int64_t)i;
+        if (reference >= 0 && i - (size_t)reference <= 65535 && read32(src + reference) == sequence) {
+            size_t length = MinMatch;
+            while (i + length < size - LastLiterals && src[reference + length] == src[i + length])
+                ++length;
+            writeSequence(out, src + anchor, i - anchor, i - (size_t)reference, length);
+            i += length;
+            anchor = i;
+        } else {
+            ++i;
+        }
+    }
+    writeSequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+bool readLength(const uint8_t *&p, const uint8_t *end, size_t &length)
+{
+    uint8_t byte;
+    do {
+        if (p == end)
+            return false;
+        byte = *p++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decompresses a block that must expand to exactly size bytes. Returns
+// false for anything that is not such a block instead of reading or writing
+// out of bounds.
+bool decompressBlock(const uint8_t *src, size_t srcSize, uint8_t *dst, size_t size)
+{
+    const uint8_t *p = src, *end = src + srcSize;
+    size_t written = 0;
+    while (p < end) {
+        uint8_t token = *p++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(p, end, literals))
+            return false;
+        if (literals > (size_t)(end - p) || literals > size - written)
+            return false;
+        std::memcpy(dst + written, p, literals);
+        p += literals;
+        written += literals;
+        if (p == end)
+            break;
+        if (end - p < 2)
+            return false;
+        size_t offset = p[0] | (size_t)p[1] << 8;
+        p += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(p, end, length))
+            return false;
+        length += MinMatch;
+        if (offset == 0 || offset > written || length > size - written)
+            return false;
+        // Byte by byte, as a match may overlap what it writes
+        for (size_t j = 0; j < length; ++j, ++written)
+            dst[written] = dst[written - offset];
+    }
+    return written == size;
+}
+
+inline uint16_t encodeValue(float value, const BakedOceanHeader &header, int channel)
+{
+    if (header.encoding == BakedEncoding::Half)
+        return floatToHalf(value);
+    float q = std::round((value - header.bias[channel]) / header.scale[channel] * 32767.0f);
+    return (uint16_t)(int16_t)std::max(-32767.0f, std::min(32767.0f, q));
+}
+
+inline float decodeValue(uint16_t value, const BakedOceanHeader &header, int channel)
+{
+    if (header.encoding == BakedEncoding::Half)
+        return halfToFloat(value);
+    return (int16_t)value * (1.0f / 32767.0f) * header.scale[channel] + header.bias[channel];
+}
+
+}
+
+BakedOceanHeader bakedOceanHeader(int resolution, float length, glm::vec2 wind, float amplitude,
+                                  float frameRate, BakedEncoding encoding, BakedCompression compression)
+{
+    BakedOceanHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version = Version;
+    header.resolution = (uint32_t)resolution;
+    header.length = length;
+    header.windX = wind.x;
+    header.windZ = wind.y;
+    header.amplitude = amplitude;
+    header.frameRate = frameRate;
+    header.layout = BakedLayout::TextureMaps;
+    header.encoding = encoding;
+    header.compression = compression;
+    for (int channel = 0; channel < 6; ++channel) {
+        header.scale[channel] = 0.5f;
+        header.bias[channel] = 0.5f;
+    }
+    return header;
+}
+
+BakedOceanWriter::BakedOceanWriter(const std::string &path, const BakedOceanHeader &header)
+        : file(path, std::ios::binary), header(header), finished(false)
+{
+    if (!file)
+        throw std::runtime_error("BakedOceanWriter: cannot write " + path);
+    this->header.frameCount = 0;
+    this->header.indexOffset = 0;
+    // Written again with the frame count and index by finish
+    file.write(reinterpret_cast<const char *>(&this->header), sizeof(this->header));
+    size_t count = 6 * (size_t)header.resolution * header.resolution;
+    values.resize(count);
+    if (header.compression == BakedCompression::LZ4)
+        bytes.resize(2 * count);
+}
+
+BakedOceanWriter::~BakedOceanWriter()
+{
+    if (!finished) {
+        try {
+            finish();
+        } catch (const std::exception &) {
+            // Destructors must not throw, finish reports the error instead
+        }
+    }
+}
+
+void BakedOceanWriter::pad()
+{
+    static const char zeros[BakedFrameAlignment] = {};
+    auto offset = (uint64_t)file.tellp();
+    file.write(zeros, (std::streamsize)((BakedFrameAlignment - offset % BakedFrameAlignment) % BakedFrameAlignment));
+}
+
+void BakedOceanWriter::write(const float *heightMap, const float *normalMap)
+{
+    size_t mapSize = 3 * (size_t)header.resolution * header.resolution;
+    for (size_t i = 0; i < mapSize; ++i) {
+        values[i] = encodeValue(heightMap[i], header, (int)(i % 3));
+        values[mapSize + i] = encodeValue(normalMap[i], header, 3 + (int)(i % 3));
+    }
+
+    const char *data = reinterpret_cast<const char *>(values.data());
+    size_t size = values.size() * sizeof(uint16_t);
+    if (header.compression == BakedCompression::LZ4) {
+        // Differences to the texel before, low bytes then high bytes
+        size_t count = values.size();
+        for (size_t map = 0; map < 2; ++map) {
+            uint16_t previous[3] = {0, 0, 0};
+            for (size_t i = 0; i < mapSize; ++i) {
+                size_t index = map * mapSize + i;
+                uint16_t difference = (uint16_t)(values[index] - previous[i % 3]);
+                previous[i % 3] = values[index];
+                bytes[index] = (uint8_t)(difference & 0xff);
+                bytes[count + index] = (uint8_t)(difference >> 8);
+            }
+        }
+        compressBlock(bytes.data(), bytes.size(), compressed);
+        data = reinterpret_cast<const char *>(compressed.data());
+        size = compressed.size();
+    }
+
+    pad();
+    index.push_back({(uint64_t)file.tellp(), size});
+    file.write(data, (std::streamsize)size);
+}
+
+void BakedOceanWriter::finish()
+{
+    finished = true;
+    header.frameCount = (uint32_t)index.size();
+    pad();
+    header.indexOffset = (uint64_t)file.tellp();
+    file.write(reinterpret_cast<const char *>(index.data()),
+               (std::streamsize)(index.size() * sizeof(BakedFrameEntry)));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.close();
+    if (!file)
+        throw std::runtime_error("BakedOceanWriter: writing the file failed");
+}
+
+BakedOceanFile::BakedOceanFile(const std::string &path)
+        : data(nullptr), size(0), index(nullptr)
+{
+#ifdef _WIN32
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, nullptr);
+    mappingHandle = nullptr;
+    LARGE_INTEGER fileSize;
+    if (fileHandle != INVALID_HANDLE_VALUE && GetFileSizeEx(fileHandle, &fileSize)) {
+        size = (size_t)fileSize.QuadPart;
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle)
+            data = static_cast<const uint8_t *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (!data) {
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        throw std::runtime_error("BakedOceanFile: cannot map " + path);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd >= 0 && fstat(fd, &status) == 0 && status.st_size > 0) {
+        size = (size_t)status.st_size;
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED)
+            data = static_cast<const uint8_t *>(mapping);
+    }
+    if (fd >= 0)
+        close(fd);
+    if (!data)
+        throw std::runtime_error("BakedOceanFile: cannot map " + path);
+#endif
+
+    // Checks everything decode relies on, so that a damaged file is
+    // rejected here rather than read out of bounds later
+    const char *error = nullptr;
+    if (size < sizeof(head)) {
+        error = "file too small";
+    } else {
+        std::memcpy(&head, data, sizeof(head));
+        size_t frameSize = 6 * (size_t)head.resolution * head.resolution * sizeof(uint16_t);
+        if (std::memcmp(head.magic, Magic, sizeof(Magic)) != 0)
+            error = "not a baked ocean file";
+        else if (head.version != Version)
+            error = "unsupported version";
+        else if (head.resolution == 0 || head.resolution > 65536 || head.frameCount == 0
+                 || head.layout != BakedLayout::TextureMaps
+                 || (head.encoding != BakedEncoding::Half && head.encoding != BakedEncoding::Int16)
+                 || (head.compression != BakedCompression::None && head.compression != BakedCompression::LZ4))
+            error = "invalid header";
+        else if (head.indexOffset % alignof(BakedFrameEntry) != 0 || head.indexOffset > size
+                 || (size - head.indexOffset) / sizeof(BakedFrameEntry) < head.frameCount)
+            error = "frame index out of the file";
+        else
+            index = reinterpret_cast<const BakedFrameEntry *>(data + head.indexOffset);
+        for (uint32_t frame = 0; index && !error && frame < head.frameCount; ++frame) {
+            const BakedFrameEntry &entry = index[frame];
+            if (entry.offset % BakedFrameAlignment != 0 || entry.offset > size
+                || entry.size > size - entry.offset
+                || (head.compression == BakedCompression::None && entry.size != frameSize))
+                error = "frame out of the file";
+        }
+    }
+    if (error) {
+        unmap();
+        throw std::runtime_error(std::string("BakedOceanFile: ") + path + ": " + error);
+    }
+}
+
+BakedOceanFile::~BakedOceanFile()
+{
+    unmap();
+}
+
+void BakedOceanFile::unmap()
+{
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+#else
+    munmap(const_cast<uint8_t *>(data), size);
+#endif
+}
+
+void BakedOceanFile::decode(int frame, float *heightMap, float *normalMap, uint16_t *scratch) const
+{
+    const BakedFrameEntry &entry = index[frame];
+    size_t mapSize = 3 * (size_t)head.resolution * head.resolution;
+    const uint8_t *frameData = data + entry.offset;
+    if (head.compression == BakedCompression::None) {
+        auto *values = reinterpret_cast<const uint16_t *>(frameData);
+        for (size_t i = 0; i < mapSize; ++i) {
+            heightMap[i] = decodeValue(values[i], head, (int)(i % 3));
+            normalMap[i] = decodeValue(values[mapSize + i], head, 3 + (int)(i % 3));
+        }
+        return;
+    }
+
+    size_t count = 2 * mapSize;
+    auto *bytes = reinterpret_cast<uint8_t *>(scratch);
+    if (!decompressBlock(frameData, entry.size, bytes, 2 * count))
+        throw std::runtime_error("BakedOceanFile: frame " + std::to_string(frame) + " is corrupt");
+    float *maps[] = {heightMap, normalMap};
+    for (size_t map = 0; map < 2; ++map) {
+        uint16_t previous[3] = {0, 0, 0};
+        for (size_t i = 0; i < mapSize; ++i) {
+            size_t index = map * mapSize + i;
+            uint16_t value = (uint16_t)(previous[i % 3] + (bytes[index] | bytes[count + index] << 8));
+            previous[i % 3] = value;
+            maps[map][i] = decodeValue(value, head, 3 * (int)map + (int)(i % 3));
+        }
+    }
+}
+
+void BakedOceanFile::prefetch(int frame) const
+{
+#ifndef _WIN32
+    static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    const BakedFrameEntry &entry = index[frame];
+    size_t begin = entry.offset / pageSize * pageSize;
+    posix_madvise(const_cast<uint8_t *>(data) + begin, entry.offset + entry.size - begin, POSIX_MADV_WILLNEED);
+#else
+    // The reader thread touching the pages has the same effect
+    (void)frame;
+#endif
+}
+
+BakedOceanPlayer::BakedOceanPlayer(const std::string &path, int readAhead)
+        : baked(path), readAhead(std::max(1, std::min(readAhead, baked.frameCount() - 1))),
+          readerScratch(baked.scratchSize()), callerScratch(baked.scratchSize()),
+          current(-1), stopping(false)
+{
+    // The current frame, the ones ahead and one the calling thread may
+    // decode into while the reader is busy with another
+    size_t mapSize = 3 * (size_t)baked.resolution() * baked.resolution();
+    slots.resize(this->readAhead + 2);
+    for (auto &slot : slots) {
+        slot.frame = -1;
+        slot.ready = false;
+        slot.heightMap = new float[mapSize];
+        slot.normalMap = new float[mapSize];
+    }
+    reader = std::thread(&BakedOceanPlayer::readerLoop, this);
+}
+
+BakedOceanPlayer::~BakedOceanPlayer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    reader.join();
+    for (auto &slot : slots) {
+        delete[] slot.heightMap;
+        delete[] slot.normalMap;
+    }
+}
+
+int BakedOceanPlayer::frameAt(float time) const
+{
+    auto frame = (long long)std::floor((double)time * baked.header().frameRate);
+    int frames = baked.frameCount();
+    return (int)((frame % frames + frames) % frames);
+}
+
+bool BakedOceanPlayer::ahead(int frame) const
+{
+    int distance = (frame - current + baked.frameCount()) % baked.frameCount();
+    return current >= 0 && distance >= 1 && distance <= readAhead;
+}
+
+int BakedOceanPlayer::freeSlot() const
+{
+    // Slots that are empty or hold a finished frame nobody needs any more
+    for (size_t i = 0; i < slots.size(); ++i)
+        if (slots[i].frame < 0 || (slots[i].ready && slots[i].frame != current && !ahead(slots[i].frame)))
+            return (int)i;
+    return -1;
+}
+
+void BakedOceanPlayer::readerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        // The first frame ahead that is not decoded yet
+        int target = -1;
+        for (int distance = 1; current >= 0 && distance <= readAhead && target < 0; ++distance) {
+            int frame = (current + distance) % baked.frameCount();
+            if (std::none_of(slots.begin(), slots.end(), [&](const Slot &s) { return s.frame == frame; }))
+                target = frame;
+        }
+        int slot = target >= 0 ? freeSlot() : -1;
+        if (slot < 0) {
+            changed.wait(lock);
+            continue;
+        }
+        slots[slot].frame = target;
+        slots[slot].ready = false;
+        int further = (current + readAhead + 1) % baked.frameCount();
+        lock.unlock();
+
+        baked.prefetch(further);
+        bool decoded = true;
+        try {
+            baked.decode(target, slots[slot].heightMap, slots[slot].normalMap, readerScratch.data());
+        } catch (const std::exception &) {
+            decoded = false;
+        }
+
+        lock.lock();
+        if (decoded) {
+            slots[slot].ready = true;
+        } else {
+            // Leave the frame to acquire, which reports the error, and stop
+            // reading ahead of a damaged file
+            slots[slot].frame = -1;
+            stopping = true;
+        }
+        changed.notify_all();
+    }
+}
+
+void BakedOceanPlayer::acquire(int frame, const float *&heightMap, const float *&normalMap)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    current = frame;
+    changed.notify_all();
+    while (true) {
+        auto found = std::find_if(slots.begin(), slots.end(), [&](const Slot &s) { return s.frame == frame; });
+        if (found == slots.end())
+            break;
+        if (found->ready) {
+            heightMap = found->heightMap;
+            normalMap = found->normalMap;
+            return;
+        }
+        changed.wait(lock);
+    }
+
+    // Not decoded ahead, so decode it here. There is always a free slot, as
+    // at most readAhead hold frames ahead and one is being decoded.
+    Slot &slot = slots[freeSlot()];
+    slot.frame = frame;
+    slot.ready = false;
+    lock.unlock();
+    try {
+        baked.decode(frame, slot.heightMap, slot.normalMap, callerScratch.data());
+    } catch (...) {
+        lock.lock();
+        slot.frame = -1;
+        throw;
+    }
+    lock.lock();
+    slot.ready = true;
+    heightMap = slot.heightMap;
+    normalMap = slot.normalMap;
+    changed.notify_all();
+}
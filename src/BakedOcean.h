@@ -0,0 +1,227 @@
+//
+// Baked ocean animations
+//
+// A baked file holds the height and normal maps of every frame of an ocean
+// animation, as OceanSimulator::packTextures packs them, so it can be
+// played back at the cost of reading and uploading the maps, without any
+// spectrum or FFT. The file is
+//   BakedOceanHeader
+//   frames, each starting at a multiple of BakedFrameAlignment bytes
+//   frameCount BakedFrameEntry at indexOffset
+// in the byte order of the machine that wrote it.
+//
+// A frame holds the 3*N*N values of the height map followed by the 3*N*N of
+// the normal map, each as a half or a quantized int16. Compressed frames are
+// one LZ4 block each, of the values after two transforms that make them
+// compress well: every value is replaced by its difference to the same
+// channel of the texel before, then the low bytes of all values are stored
+// before all high bytes.
+//
+
+#ifndef PROJECT_BAKED_OCEAN_H
+#define PROJECT_BAKED_OCEAN_H
+
+// GLM Math Library
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class BakedEncoding : uint32_t
+{
+    // IEEE half precision
+    Half = 0,
+    // value = q / 32767 * scale + bias for the channel
+    Int16 = 1,
+};
+
+enum class BakedCompression : uint32_t
+{
+    None = 0,
+    LZ4 = 1,
+};
+
+enum class BakedLayout : uint32_t
+{
+    // The RGB height map then the RGB normal map of Ocean, six channels
+    TextureMaps = 0,
+};
+
+struct BakedOceanHeader
+{
+    // "OCEANBAK"
+    char magic[8];
+    uint32_t version;
+    uint32_t resolution;
+    // Side length of the simulated patch
+    float length;
+    float windX, windZ;
+    float amplitude;
+    // Frames per second of simulation time
+    float frameRate;
+    uint32_t frameCount;
+    BakedLayout layout;
+    BakedEncoding encoding;
+    BakedCompression compression;
+    // Int16 decoding of every channel
+    float scale[6];
+    float bias[6];
+    uint32_t reserved;
+    uint64_t indexOffset;
+};
+
+// Where a frame is stored
+struct BakedFrameEntry
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+const int BakedFrameAlignment = 64;
+
+// A header for frames of the given resolution and simulation parameters.
+// The int16 channels cover [0, 1], the range of the texture maps.
+BakedOceanHeader bakedOceanHeader(int resolution, float length, glm::vec2 wind, float amplitude,
+                                  float frameRate, BakedEncoding encoding, BakedCompression compression);
+
+class BakedOceanWriter
+{
+public:
+    // Creates the file at path. Throws std::runtime_error if it cannot be
+    // written. The frame count and index of the header are filled in by
+    // finish.
+    BakedOceanWriter(const std::string &path, const BakedOceanHeader &header);
+    // Finishes the file if finish was not called
+    ~BakedOceanWriter();
+
+    BakedOceanWriter(const BakedOceanWriter &) = delete;
+    BakedOceanWriter &operator=(const BakedOceanWriter &) = delete;
+
+    // Appends a frame. Both maps hold 3*N*N floats.
+    void write(const float *heightMap, const float *normalMap);
+
+    // Writes the frame index and the final header. Throws
+    // std::runtime_error if writing any part of the file failed.
+    void finish();
+
+private:
+    std::ofstream file;
+    BakedOceanHeader header;
+    std::vector<BakedFrameEntry> index;
+    std::vector<uint16_t> values;
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> compressed;
+    bool finished;
+
+    // Writes zeros up to the next multiple of BakedFrameAlignment
+    void pad();
+};
+
+/*
+ * A baked file mapped into memory. Frames are decoded straight from the
+ * mapping, so only the pages of the frames that are read are loaded.
+ */
+class BakedOceanFile
+{
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a
+    // valid baked file
+    explicit BakedOceanFile(const std::string &path);
+    ~BakedOceanFile();
+
+    BakedOceanFile(const BakedOceanFile &) = delete;
+    BakedOceanFile &operator=(const BakedOceanFile &) = delete;
+
+    const BakedOceanHeader &header() const { return head; }
+
+    int resolution() const { return (int)head.resolution; }
+
+    int frameCount() const { return (int)head.frameCount; }
+
+    // Decodes frame into the maps, 3*N*N floats each. scratch must hold
+    // scratchSize() values. May be called from several threads at once
+    // with different scratch buffers. Throws std::runtime_error if the
+    // frame is corrupt.
+    void decode(int frame, float *heightMap, float *normalMap, uint16_t *scratch) const;
+
+    size_t scratchSize() const { return 6 * (size_t)head.resolution * head.resolution; }
+
+    // Asks the OS to start reading frame in, without waiting for it
+    void prefetch(int frame) const;
+
+private:
+    BakedOceanHeader head;
+    const uint8_t *data;
+    size_t size;
+    const BakedFrameEntry *index;
+#ifdef _WIN32
+    void *fileHandle;
+    void *mappingHandle;
+#endif
+
+    void unmap();
+};
+
+/*
+ * Plays a baked file back, decoding the frames after the one shown on a
+ * background thread. Frames are expected mostly in order, wrapping around
+ * at the end; any other frame is decoded on the calling thread.
+ */
+class BakedOceanPlayer
+{
+public:
+    // Keeps up to readAhead frames after the current one decoded. Throws
+    // like BakedOceanFile.
+    explicit BakedOceanPlayer(const std::string &path, int readAhead = 4);
+    ~BakedOceanPlayer();
+
+    BakedOceanPlayer(const BakedOceanPlayer &) = delete;
+    BakedOceanPlayer &operator=(const BakedOceanPlayer &) = delete;
+
+    const BakedOceanFile &file() const { return baked; }
+
+    // The frame shown at time, looping over the animation
+    int frameAt(float time) const;
+
+    // Makes frame the current one and points the maps at its decoded
+    // values, 3*N*N floats each, which stay valid until the next call.
+    // Must always be called from the same thread.
+    void acquire(int frame, const float *&heightMap, const float *&normalMap);
+
+private:
+    struct Slot
+    {
+        int frame;
+        bool ready;
+        float *heightMap;
+        float *normalMap;
+    };
+
+    BakedOceanFile baked;
+    int readAhead;
+    std::vector<Slot> slots;
+    // Scratch of the decoding on the reader and the calling thread
+    std::vector<uint16_t> readerScratch;
+    std::vector<uint16_t> callerScratch;
+
+    // Guards the slots and current
+    std::mutex mutex;
+    std::condition_variable changed;
+    int current;
+    bool stopping;
+    std::thread reader;
+
+    void readerLoop();
+    // Whether frame is one of the readAhead after current
+    bool ahead(int frame) const;
+    // A slot the reader may decode into, or -1
+    int freeSlot() const;
+};
+
+
+#endif //PROJECT_BAKED_OCEAN_H
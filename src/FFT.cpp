@@ -0,0 +1,1372 @@
+//
+// Plan-based FFT engine shared by the ocean simulators
+//
+
+#include "FFT.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+// First pass when log2(n) is odd: size-2 transforms need no twiddles
+void radix2Scalar(float *re, float *im, int n)
+{
+    for (int k = 0; k < n; k += 2) {
+        float ur = re[k], ui = im[k];
+        float tr = re[k + 1], ti = im[k + 1];
+        re[k] = ur + tr;
+        im[k] = ui + ti;
+        re[k + 1] = ur - tr;
+        im[k + 1] = ui - ti;
+    }
+}
+
+// Merges four transforms of size q into one of size 4q. With inputs
+// A, B, C, D at j, j+q, j+2q, j+3q and b = W^2j*B, c = W^j*C, d = W^3j*D:
+//   out[j]    = (A + b) + (c + d)
+//   out[j+q]  = (A - b) + i*(c - d)
+//   out[j+2q] = (A + b) - (c + d)
+//   out[j+3q] = (A - b) - i*(c - d)
+void radix4Scalar(float *re, float *im, int n, int q, const float *tw)
+{
+    const float *w1r = tw, *w1i = tw + q;
+    const float *w2r = tw + 2 * q, *w2i = tw + 3 * q;
+    const float *w3r = tw + 4 * q, *w3i = tw + 5 * q;
+    for (int k = 0; k < n; k += 4 * q) {
+        float *r0 = re + k, *r1 = r0 + q, *r2 = r1 + q, *r3 = r2 + q;
+        float *i0 = im + k, *i1 = i0 + q, *i2 = i1 + q, *i3 = i2 + q;
+        for (int j = 0; j < q; ++j) {
+            float br = r1[j] * w2r[j] - i1[j] * w2i[j], bi = r1[j] * w2i[j] + i1[j] * w2r[j];
+            float cr = r2[j] * w1r[j] - i2[j] * w1i[j], ci = r2[j] * w1i[j] + i2[j] * w1r[j];
+            float dr = r3[j] * w3r[j] - i3[j] * w3i[j], di = r3[j] * w3i[j] + i3[j] * w3r[j];
+            float s0r = r0[j] + br, s0i = i0[j] + bi;
+            float d0r = r0[j] - br, d0i = i0[j] - bi;
+            float s1r = cr + dr, s1i = ci + di;
+            float d1r = cr - dr, d1i = ci - di;
+            r0[j] = s0r + s1r;
+            i0[j] = s0i + s1i;
+            r2[j] = s0r - s1r;
+            i2[j] = s0i - s1i;
+            r1[j] = d0r - d1i;
+            i1[j] = d0i + d1r;
+            r3[j] = d0r + d1i;
+            i3[j] = d0i - d1r;
+        }
+    }
+}
+
+// One Stockham pass, splitting transforms of size 4m into four of size m.
+// x holds s interleaved transforms, element p of transform q at q + s*p.
+// With a, b, c, d at p, p+m, p+2m, p+3m and W = exp(2*PI*i/(4m)):
+//   y[4p]   = (a + c) + (b + d)
+//   y[4p+1] = W^p  * ((a - c) + i*(b - d))
+//   y[4p+2] = W^2p * ((a + c) - (b + d))
+//   y[4p+3] = W^3p * ((a - c) - i*(b - d))
+// written as 4s interleaved transforms, which keeps every access contiguous
+// in q.
+void stockham4Scalar(const float *xr, const float *xi, float *yr, float *yi, int m, int s,
+                     const float *tw)
+{
+    const float *w1r = tw, *w1i = tw + m;
+    const float *w2r = tw + 2 * m, *w2i = tw + 3 * m;
+    const float *w3r = tw + 4 * m, *w3i = tw + 5 * m;
+    int ms = m * s;
+    for (int p = 0; p < m; ++p) {
+        const float *ar = xr + s * p, *ai = xi + s * p;
+        float *r0 = yr + 4 * s * p, *r1 = r0 + s, *r2 = r1 + s, *r3 = r2 + s;
+        float *i0 = yi + 4 * s * p, *i1 = i0 + s, *i2 = i1 + s, *i3 = i2 + s;
+        for (int q = 0; q < s; ++q) {
+            float apcr = ar[q] + ar[q + 2 * ms], apci = ai[q] + ai[q + 2 * ms];
+            float amcr = ar[q] - ar[q + 2 * ms], amci = ai[q] - ai[q + 2 * ms];
+            float bpdr = ar[q + ms] + ar[q + 3 * ms], bpdi = ai[q + ms] + ai[q + 3 * ms];
+            float bmdr = ar[q + ms] - ar[q + 3 * ms], bmdi = ai[q + ms] - ai[q + 3 * ms];
+            float ur = amcr - bmdi, ui = amci + bmdr;
+            float vr = apcr - bpdr, vi = apci - bpdi;
+            float tr = amcr + bmdi, ti = amci - bmdr;
+            r0[q] = apcr + bpdr;
+            i0[q] = apci + bpdi;
+            r1[q] = ur * w1r[p] - ui * w1i[p];
+            i1[q] = ur * w1i[p] + ui * w1r[p];
+            r2[q] = vr * w2r[p] - vi * w2i[p];
+            i2[q] = vr * w2i[p] + vi * w2r[p];
+            r3[q] = tr * w3r[p] - ti * w3i[p];
+            i3[q] = tr * w3i[p] + ti * w3r[p];
+        }
+    }
+}
+
+// Last Stockham pass when n has an odd power of two: s transforms of size 2
+void stockham2Scalar(const float *xr, const float *xi, float *yr, float *yi, int s)
+{
+    for (int q = 0; q < s; ++q) {
+        float ar = xr[q], ai = xi[q], br = xr[q + s], bi = xi[q + s];
+        yr[q] = ar + br;
+        yi[q] = ai + bi;
+        yr[q + s] = ar - br;
+        yi[q + s] = ai - bi;
+    }
+}
+
+// Constants of the radix-3 and radix-5 butterflies: sin(2*PI/3), and the
+// cosines and sines of 2*PI/5 and 4*PI/5
+const float Sin3 = 0.866025403784438647f;
+const float Cos5a = 0.309016994374947424f, Sin5a = 0.951056516295153572f;
+const float Cos5b = -0.809016994374947424f, Sin5b = 0.587785252292473129f;
+
+// Stockham pass splitting transforms of size 3m into three of size m, laid
+// out as in stockham4Scalar. With a, b, c at p, p+m, p+2m, W = exp(2*PI*i/(3m))
+// and r = a - (b + c)/2, t = sin(2*PI/3)*(b - c):
+//   y[3p]   = a + b + c
+//   y[3p+1] = W^p  * (r + i*t)
+//   y[3p+2] = W^2p * (r - i*t)
+void stockham3Scalar(const float *xr, const float *xi, float *yr, float *yi, int m, int s,
+                     const float *tw)
+{
+    const float *w1r = tw, *w1i = tw + m;
+    const float *w2r = tw + 2 * m, *w2i = tw + 3 * m;
+    int ms = m * s;
+    for (int p = 0; p < m; ++p) {
+        const float *ar = xr + s * p, *ai = xi + s * p;
+        float *r0 = yr + 3 * s * p, *r1 = r0 + s, *r2 = r1 + s;
+        float *i0 = yi + 3 * s * p, *i1 = i0 + s, *i2 = i1 + s;
+        for (int q = 0; q < s; ++q) {
+            float bpcr = ar[q + ms] + ar[q + 2 * ms], bpci = ai[q + ms] + ai[q + 2 * ms];
+            float tr = Sin3 * (ar[q + ms] - ar[q + 2 * ms]), ti = Sin3 * (ai[q + ms] - ai[q + 2 * ms]);
+            float rr = ar[q] - 0.5f * bpcr, ri = ai[q] - 0.5f * bpci;
+            float ur = rr - ti, ui = ri + tr;
+            float vr = rr + ti, vi = ri - tr;
+            r0[q] = ar[q] + bpcr;
+            i0[q] = ai[q] + bpci;
+            r1[q] = ur * w1r[p] - ui * w1i[p];
+            i1[q] = ur * w1i[p] + ui * w1r[p];
+            r2[q] = vr * w2r[p] - vi * w2i[p];
+            i2[q] = vr * w2i[p] + vi * w2r[p];
+        }
+    }
+}
+
+// Stockham pass splitting transforms of size 5m into five of size m. With
+// x0..x4 at p, p+m, ..., p+4m, t1 = x1 + x4, t2 = x2 + x3, d1 = x1 - x4 and
+// d2 = x2 - x3:
+//   y[5p]            = x0 + t1 + t2
+//   y[5p+1], y[5p+4] = x0 + cos(2PI/5)*t1 + cos(4PI/5)*t2 +- i*(sin(2PI/5)*d1 + sin(4PI/5)*d2)
+//   y[5p+2], y[5p+3] = x0 + cos(4PI/5)*t1 + cos(2PI/5)*t2 +- i*(sin(4PI/5)*d1 - sin(2PI/5)*d2)
+// each multiplied by W^jp for output j, W = exp(2*PI*i/(5m)).
+void stockham5Scalar(const float *xr, const float *xi, float *yr, float *yi, int m, int s,
+                     const float *tw)
+{
+    int ms = m * s;
+    for (int p = 0; p < m; ++p) {
+        const float *ar = xr + s * p, *ai = xi + s * p;
+        float *outr = yr + 5 * s * p, *outi = yi + 5 * s * p;
+        for (int q = 0; q < s; ++q) {
+            float x0r = ar[q], x0i = ai[q];
+            float t1r = ar[q + ms] + ar[q + 4 * ms], t1i = ai[q + ms] + ai[q + 4 * ms];
+            float t2r = ar[q + 2 * ms] + ar[q + 3 * ms], t2i = ai[q + 2 * ms] + ai[q + 3 * ms];
+            float d1r = ar[q + ms] - ar[q + 4 * ms], d1i = ai[q + ms] - ai[q + 4 * ms];
+            float d2r = ar[q + 2 * ms] - ar[q + 3 * ms], d2i = ai[q + 2 * ms] - ai[q + 3 * ms];
+            float ar1 = x0r + Cos5a * t1r + Cos5b * t2r, ai1 = x0i + Cos5a * t1i + Cos5b * t2i;
+            float ar2 = x0r + Cos5b * t1r + Cos5a * t2r, ai2 = x0i + Cos5b * t1i + Cos5a * t2i;
+            float br1 = Sin5a * d1r + Sin5b * d2r, bi1 = Sin5a * d1i + Sin5b * d2i;
+            float br2 = Sin5b * d1r - Sin5a * d2r, bi2 = Sin5b * d1i - Sin5a * d2i;
+            // Outputs before the twiddles, a + i*b and a - i*b
+            float ur[5] = {x0r + t1r + t2r, ar1 - bi1, ar2 - bi2, ar2 + bi2, ar1 + bi1};
+            float ui[5] = {x0i + t1i + t2i, ai1 + br1, ai2 + br2, ai2 - br2, ai1 - br1};
+            outr[q] = ur[0];
+            outi[q] = ui[0];
+            for (int j = 1; j < 5; ++j) {
+                float wr = tw[2 * (j - 1) * m + p], wi = tw[(2 * j - 1) * m + p];
+                outr[q + j * s] = ur[j] * wr - ui[j] * wi;
+                outi[q + j * s] = ur[j] * wi + ui[j] * wr;
+            }
+        }
+    }
+}
+
+#ifdef OCEAN_SIMD_X86
+
+// Same as radix4Scalar, four butterflies at a time. q must be a multiple of 4.
+void radix4SSE2(float *re, float *im, int n, int q, const float *tw)
+{
+    const float *w1r = tw, *w1i = tw + q;
+    const float *w2r = tw + 2 * q, *w2i = tw + 3 * q;
+    const float *w3r = tw + 4 * q, *w3i = tw + 5 * q;
+    for (int k = 0; k < n; k += 4 * q) {
+        float *r0 = re + k, *r1 = r0 + q, *r2 = r1 + q, *r3 = r2 + q;
+        float *i0 = im + k, *i1 = i0 + q, *i2 = i1 + q, *i3 = i2 + q;
+        for (int j = 0; j < q; j += 4) {
+            __m128 xr = _mm_loadu_ps(r1 + j), xi = _mm_loadu_ps(i1 + j);
+            __m128 wr = _mm_loadu_ps(w2r + j), wi = _mm_loadu_ps(w2i + j);
+            __m128 br = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+            __m128 bi = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+            xr = _mm_loadu_ps(r2 + j); xi = _mm_loadu_ps(i2 + j);
+            wr = _mm_loadu_ps(w1r + j); wi = _mm_loadu_ps(w1i + j);
+            __m128 cr = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+            __m128 ci = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+            xr = _mm_loadu_ps(r3 + j); xi = _mm_loadu_ps(i3 + j);
+            wr = _mm_loadu_ps(w3r + j); wi = _mm_loadu_ps(w3i + j);
+            __m128 dr = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+            __m128 di = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+            __m128 ar = _mm_loadu_ps(r0 + j), ai = _mm_loadu_ps(i0 + j);
+            __m128 s0r = _mm_add_ps(ar, br), s0i = _mm_add_ps(ai, bi);
+            __m128 d0r = _mm_sub_ps(ar, br), d0i = _mm_sub_ps(ai, bi);
+            __m128 s1r = _mm_add_ps(cr, dr), s1i = _mm_add_ps(ci, di);
+            __m128 d1r = _mm_sub_ps(cr, dr), d1i = _mm_sub_ps(ci, di);
+            _mm_storeu_ps(r0 + j, _mm_add_ps(s0r, s1r));
+            _mm_storeu_ps(i0 + j, _mm_add_ps(s0i, s1i));
+            _mm_storeu_ps(r2 + j, _mm_sub_ps(s0r, s1r));
+            _mm_storeu_ps(i2 + j, _mm_sub_ps(s0i, s1i));
+            _mm_storeu_ps(r1 + j, _mm_sub_ps(d0r, d1i));
+            _mm_storeu_ps(i1 + j, _mm_add_ps(d0i, d1r));
+            _mm_storeu_ps(r3 + j, _mm_add_ps(d0r, d1i));
+            _mm_storeu_ps(i3 + j, _mm_sub_ps(d0i, d1r));
+        }
+    }
+}
+
+// Same as radix4Scalar, eight butterflies at a time. q must be a multiple of 8.
+OCEAN_TARGET_AVX2
+void radix4AVX2(float *re, float *im, int n, int q, const float *tw)
+{
+    const float *w1r = tw, *w1i = tw + q;
+    const float *w2r = tw + 2 * q, *w2i = tw + 3 * q;
+    const float *w3r = tw + 4 * q, *w3i = tw + 5 * q;
+    for (int k = 0; k < n; k += 4 * q) {
+        float *r0 = re + k, *r1 = r0 + q, *r2 = r1 + q, *r3 = r2 + q;
+        float *i0 = im + k, *i1 = i0 + q, *i2 = i1 + q, *i3 = i2 + q;
+        for (int j = 0; j < q; j += 8) {
+            __m256 xr = _mm256_loadu_ps(r1 + j), xi = _mm256_loadu_ps(i1 + j);
+            __m256 wr = _mm256_loadu_ps(w2r + j), wi = _mm256_loadu_ps(w2i + j);
+            __m256 br = _mm256_fmsub_ps(xr, wr, _mm256_mul_ps(xi, wi));
+            __m256 bi = _mm256_fmadd_ps(xr, wi, _mm256_mul_ps(xi, wr));
+            xr = _mm256_loadu_ps(r2 + j); xi = _mm256_loadu_ps(i2 + j);
+            wr = _mm256_loadu_ps(w1r + j); wi = _mm256_loadu_ps(w1i + j);
+            __m256 cr = _mm256_fmsub_ps(xr, wr, _mm256_mul_ps(xi, wi));
+            __m256 ci = _mm256_fmadd_ps(xr, wi, _mm256_mul_ps(xi, wr));
+            xr = _mm256_loadu_ps(r3 + j); xi = _mm256_loadu_ps(i3 + j);
+            wr = _mm256_loadu_ps(w3r + j); wi = _mm256_loadu_ps(w3i + j);
+            __m256 dr = _mm256_fmsub_ps(xr, wr, _mm256_mul_ps(xi, wi));
+            __m256 di = _mm256_fmadd_ps(xr, wi, _mm256_mul_ps(xi, wr));
+            __m256 ar = _mm256_loadu_ps(r0 + j), ai = _mm256_loadu_ps(i0 + j);
+            __m256 s0r = _mm256_add_ps(ar, br), s0i = _mm256_add_ps(ai, bi);
+            __m256 d0r = _mm256_sub_ps(ar, br), d0i = _mm256_sub_ps(ai, bi);
+            __m256 s1r = _mm256_add_ps(cr, dr), s1i = _mm256_add_ps(ci, di);
+            __m256 d1r = _mm256_sub_ps(cr, dr), d1i = _mm256_sub_ps(ci, di);
+            _mm256_storeu_ps(r0 + j, _mm256_add_ps(s0r, s1r));
+            _mm256_storeu_ps(i0 + j, _mm256_add_ps(s0i, s1i));
+            _mm256_storeu_ps(r2 + j, _mm256_sub_ps(s0r, s1r));
+            _mm256_storeu_ps(i2 + j, _mm256_sub_ps(s0i, s1i));
+            _mm256_storeu_ps(r1 + j, _mm256_sub_ps(d0r, d1i));
+            _mm256_storeu_ps(i1 + j, _mm256_add_ps(d0i, d1r));
+            _mm256_storeu_ps(r3 + j, _mm256_add_ps(d0r, d1i));
+            _mm256_storeu_ps(i3 + j, _mm256_sub_ps(d0i, d1r));
+        }
+    }
+}
+
+// Same as stockham4Scalar, four transforms at a time. s must be a multiple of 4.
+void stockham4SSE2(const float *xr, const float *xi, float *yr, float *yi, int m, int s,
+                   const float *tw)
+{
+    int ms = m * s;
+    for (int p = 0; p < m; ++p) {
+        __m128 w1r = _mm_set1_ps(tw[p]), w1i = _mm_set1_ps(tw[m + p]);
+        __m128 w2r = _mm_set1_ps(tw[2 * m + p]), w2i = _mm_set1_ps(tw[3 * m + p]);
+        __m128 w3r = _mm_set1_ps(tw[4 * m + p]), w3i = _mm_set1_ps(tw[5 * m + p]);
+        const float *ar = xr + s * p, *ai = xi + s * p;
+        float *r0 = yr + 4 * s * p, *r1 = r0 + s, *r2 = r1 + s, *r3 = r2 + s;
+        float *i0 = yi + 4 * s * p, *i1 = i0 + s, *i2 = i1 + s, *i3 = i2 + s;
+        for (int q = 0; q < s; q += 4) {
+            __m128 xar = _mm_loadu_ps(ar + q), xai = _mm_loadu_ps(ai + q);
+            __m128 xbr = _mm_loadu_ps(ar + q + ms), xbi = _mm_loadu_ps(ai + q + ms);
+            __m128 xcr = _mm_loadu_ps(ar + q + 2 * ms), xci = _mm_loadu_ps(ai + q + 2 * ms);
+            __m128 xdr = _mm_loadu_ps(ar + q + 3 * ms), xdi = _mm_loadu_ps(ai + q + 3 * ms);
+            __m128 apcr = _mm_add_ps(xar, xcr), apci = _mm_add_ps(xai, xci);
+            __m128 amcr = _mm_sub_ps(xar, xcr), amci = _mm_sub_ps(xai, xci);
+            __m128 bpdr = _mm_add_ps(xbr, xdr), bpdi = _mm_add_ps(xbi, xdi);
+            __m128 bmdr = _mm_sub_ps(xbr, xdr), bmdi = _mm_sub_ps(xbi, xdi);
+            __m128 ur = _mm_sub_ps(amcr, bmdi), ui = _mm_add_ps(amci, bmdr);
+            __m128 vr = _mm_sub_ps(apcr, bpdr), vi = _mm_sub_ps(apci, bpdi);
+            __m128 tr = _mm_add_ps(amcr, bmdi), ti = _mm_sub_ps(amci, bmdr);
+            _mm_storeu_ps(r0 + q, _mm_add_ps(apcr, bpdr));
+            _mm_storeu_ps(i0 + q, _mm_add_ps(apci, bpdi));
+            _mm_storeu_ps(r1 + q, _mm_sub_ps(_mm_mul_ps(ur, w1r), _mm_mul_ps(ui, w1i)));
+            _mm_storeu_ps(i1 + q, _mm_add_ps(_mm_mul_ps(ur, w1i), _mm_mul_ps(ui, w1r)));
+            _mm_storeu_ps(r2 + q, _mm_sub_ps(_mm_mul_ps(vr, w2r), _mm_mul_ps(vi, w2i)));
+            _mm_storeu_ps(i2 + q, _mm_add_ps(_mm_mul_ps(vr, w2i), _mm_mul_ps(vi, w2r)));
+            _mm_storeu_ps(r3 + q, _mm_sub_ps(_mm_mul_ps(tr, w3r), _mm_mul_ps(ti, w3i)));
+            _mm_storeu_ps(i3 + q, _mm_add_ps(_mm_mul_ps(tr, w3i), _mm_mul_ps(ti, w3r)));
+        }
+    }
+}
+
+// Same as stockham4Scalar, eight transforms at a time. s must be a multiple of 8.
+OCEAN_TARGET_AVX2
+void stockham4AVX2(const float *xr, const float *xi, float *yr, float *yi, int m, int s,
+                   const float *tw)
+{
+    int ms = m * s;
+    for (int p = 0; p < m; ++p) {
+        __m256 w1r = _mm256_set1_ps(tw[p]), w1i = _mm256_set1_ps(tw[m + p]);
+        __m256 w2r = _mm256_set1_ps(tw[2 * m + p]), w2i = _mm256_set1_ps(tw[3 * m + p]);
+        __m256 w3r = _mm256_set1_ps(tw[4 * m + p]), w3i = _mm256_set1_ps(tw[5 * m + p]);
+        const float *ar = xr + s * p, *ai = xi + s * p;
+        float *r0 = yr + 4 * s * p, *r1 = r0 + s, *r2 = r1 + s, *r3 = r2 + s;
+        float *i0 = yi + 4 * s * p, *i1 = i0 + s, *i2 = i1 + s, *i3 = i2 + s;
+        for (int q = 0; q < s; q += 8) {
+            __m256 xar = _mm256_loadu_ps(ar + q), xai = _mm256_loadu_ps(ai + q);
+            __m256 xbr = _mm256_loadu_ps(ar + q + ms), xbi = _mm256_loadu_ps(ai + q + ms);
+            __m256 xcr = _mm256_loadu_ps(ar + q + 2 * ms), xci = _mm256_loadu_ps(ai + q + 2 * ms);
+            __m256 xdr = _mm256_loadu_ps(ar + q + 3 * ms), xdi = _mm256_loadu_ps(ai + q + 3 * ms);
+            __m256 apcr = _mm256_add_ps(xar, xcr), apci = _mm256_add_ps(xai, xci);
+            __m256 amcr = _mm256_sub_ps(xar, xcr), amci = _mm256_sub_ps(xai, xci);
+            __m256 bpdr = _mm256_add_ps(xbr, xdr), bpdi = _mm256_add_ps(xbi, xdi);
+            __m256 bmdr = _mm256_sub_ps(xbr, xdr), bmdi = _mm256_sub_ps(xbi, xdi);
+            __m256 ur = _mm256_sub_ps(amcr, bmdi), ui = _mm256_add_ps(amci, bmdr);
+            __m256 vr = _mm256_sub_ps(apcr, bpdr), vi = _mm256_sub_ps(apci, bpdi);
+            __m256 tr = _mm256_add_ps(amcr, bmdi), ti = _mm256_sub_ps(amci, bmdr);
+            _mm256_storeu_ps(r0 + q, _mm256_add_ps(apcr, bpdr));
+            _mm256_storeu_ps(i0 + q, _mm256_add_ps(apci, bpdi));
+            _mm256_storeu_ps(r1 + q, _mm256_fmsub_ps(ur, w1r, _mm256_mul_ps(ui, w1i)));
+            _mm256_storeu_ps(i1 + q, _mm256_fmadd_ps(ur, w1i, _mm256_mul_ps(ui, w1r)));
+            _mm256_storeu_ps(r2 + q, _mm256_fmsub_ps(vr, w2r, _mm256_mul_ps(vi, w2i)));
+            _mm256_storeu_ps(i2 + q, _mm256_fmadd_ps(vr, w2i, _mm256_mul_ps(vi, w2r)));
+            _mm256_storeu_ps(r3 + q, _mm256_fmsub_ps(tr, w3r, _mm256_mul_ps(ti, w3i)));
+            _mm256_storeu_ps(i3 + q, _mm256_fmadd_ps(tr, w3i, _mm256_mul_ps(ti, w3r)));
+        }
+    }
+}
+
+// Same as stockham3Scalar, eight transforms at a time. s must be a multiple of 8.
+OCEAN_TARGET_AVX2
+void stockham3AVX2(const float *xr, const float *xi, float *yr, float *yi, int m, int s,
+                   const float *tw)
+{
+    const __m256 sin3 = _mm256_set1_ps(Sin3), half = _mm256_set1_ps(0.5f);
+    int ms = m * s;
+    for (int p = 0; p < m; ++p) {
+        __m256 w1r = _mm256_set1_ps(tw[p]), w1i = _mm256_set1_ps(tw[m + p]);
+        __m256 w2r = _mm256_set1_ps(tw[2 * m + p]), w2i = _mm256_set1_ps(tw[3 * m + p]);
+        const float *ar = xr + s * p, *ai = xi + s * p;
+        float *r0 = yr + 3 * s * p, *r1 = r0 + s, *r2 = r1 + s;
+        float *i0 = yi + 3 * s * p, *i1 = i0 + s, *i2 = i1 + s;
+        for (int q = 0; q < s; q += 8) {
+            __m256 xar = _mm256_loadu_ps(ar + q), xai = _mm256_loadu_ps(ai + q);
+            __m256 xbr = _mm256_loadu_ps(ar + q + ms), xbi = _mm256_loadu_ps(ai + q + ms);
+            __m256 xcr = _mm256_loadu_ps(ar + q + 2 * ms), xci = _mm256_loadu_ps(ai + q + 2 * ms);
+            __m256 bpcr = _mm256_add_ps(xbr, xcr), bpci = _mm256_add_ps(xbi, xci);
+            __m256 tr = _mm256_mul_ps(sin3, _mm256_sub_ps(xbr, xcr));
+            __m256 ti = _mm256_mul_ps(sin3, _mm256_sub_ps(xbi, xci));
+            __m256 rr = _mm256_fnmadd_ps(half, bpcr, xar), ri = _mm256_fnmadd_ps(half, bpci, xai);
+            __m256 ur = _mm256_sub_ps(rr, ti), ui = _mm256_add_ps(ri, tr);
+            __m256 vr = _mm256_add_ps(rr, ti), vi = _mm256_sub_ps(ri, tr);
+            _mm256_storeu_ps(r0 + q, _mm256_add_ps(xar, bpcr));
+            _mm256_storeu_ps(i0 + q, _mm256_add_ps(xai, bpci));
+            _mm256_storeu_ps(r1 + q, _mm256_fmsub_ps(ur, w1r, _mm256_mul_ps(ui, w1i)));
+            _mm256_storeu_ps(i1 + q, _mm256_fmadd_ps(ur, w1i, _mm256_mul_ps(ui, w1r)));
+            _mm256_storeu_ps(r2 + q, _mm256_fmsub_ps(vr, w2r, _mm256_mul_ps(vi, w2i)));
+            _mm256_storeu_ps(i2 + q, _mm256_fmadd_ps(vr, w2i, _mm256_mul_ps(vi, w2r)));
+        }
+    }
+}
+
+// Same as stockham5Scalar, eight transforms at a time. s must be a multiple of 8.
+OCEAN_TARGET_AVX2
+void stockham5AVX2(const float *xr, const float *xi, float *yr, float *yi, int m, int s,
+                   const float *tw)
+{
+    const __m256 cos5a = _mm256_set1_ps(Cos5a), sin5a = _mm256_set1_ps(Sin5a);
+    const __m256 cos5b = _mm256_set1_ps(Cos5b), sin5b = _mm256_set1_ps(Sin5b);
+    int ms = m * s;
+    for (int p = 0; p < m; ++p) {
+        const float *ar = xr + s * p, *ai = xi + s * p;
+        float *outr = yr + 5 * s * p, *outi = yi + 5 * s * p;
+        for (int q = 0; q < s; q += 8) {
+            __m256 x0r = _mm256_loadu_ps(ar + q), x0i = _mm256_loadu_ps(ai + q);
+            __m256 x1r = _mm256_loadu_ps(ar + q + ms), x1i = _mm256_loadu_ps(ai + q + ms);
+            __m256 x2r = _mm256_loadu_ps(ar + q + 2 * ms), x2i = _mm256_loadu_ps(ai + q + 2 * ms);
+            __m256 x3r = _mm256_loadu_ps(ar + q + 3 * ms), x3i = _mm256_loadu_ps(ai + q + 3 * ms);
+            __m256 x4r = _mm256_loadu_ps(ar + q + 4 * ms), x4i = _mm256_loadu_ps(ai + q + 4 * ms);
+            __m256 t1r = _mm256_add_ps(x1r, x4r), t1i = _mm256_add_ps(x1i, x4i);
+            __m256 t2r = _mm256_add_ps(x2r, x3r), t2i = _mm256_add_ps(x2i, x3i);
+            __m256 d1r = _mm256_sub_ps(x1r, x4r), d1i = _mm256_sub_ps(x1i, x4i);
+            __m256 d2r = _mm256_sub_ps(x2r, x3r), d2i = _mm256_sub_ps(x2i, x3i);
+            __m256 ar1 = _mm256_fmadd_ps(cos5b, t2r, _mm256_fmadd_ps(cos5a, t1r, x0r));
+            __m256 ai1 = _mm256_fmadd_ps(cos5b, t2i, _mm256_fmadd_ps(cos5a, t1i, x0i));
+            __m256 ar2 = _mm256_fmadd_ps(cos5a, t2r, _mm256_fmadd_ps(cos5b, t1r, x0r));
+            __m256 ai2 = _mm256_fmadd_ps(cos5a, t2i, _mm256_fmadd_ps(cos5b, t1i, x0i));
+            __m256 br1 = _mm256_fmadd_ps(sin5a, d1r, _mm256_mul_ps(sin5b, d2r));
+            __m256 bi1 = _mm256_fmadd_ps(sin5a, d1i, _mm256_mul_ps(sin5b, d2i));
+            __m256 br2 = _mm256_fmsub_ps(sin5b, d1r, _mm256_mul_ps(sin5a, d2r));
+            __m256 bi2 = _mm256_fmsub_ps(sin5b, d1i, _mm256_mul_ps(sin5a, d2i));
+            __m256 ur[5] = {_mm256_add_ps(x0r, _mm256_add_ps(t1r, t2r)), _mm256_sub_ps(ar1, bi1),
+                            _mm256_sub_ps(ar2, bi2), _mm256_add_ps(ar2, bi2), _mm256_add_ps(ar1, bi1)};
+            __m256 ui[5] = {_mm256_add_ps(x0i, _mm256_add_ps(t1i, t2i)), _mm256_add_ps(ai1, br1),
+                            _mm256_add_ps(ai2, br2), _mm256_sub_ps(ai2, br2), _mm256_sub_ps(ai1, br1)};
+            _mm256_storeu_ps(outr + q, ur[0]);
+            _mm256_storeu_ps(outi + q, ui[0]);
+            for (int j = 1; j < 5; ++j) {
+                __m256 wr = _mm256_set1_ps(tw[2 * (j - 1) * m + p]);
+                __m256 wi = _mm256_set1_ps(tw[(2 * j - 1) * m + p]);
+                _mm256_storeu_ps(outr + q + j * s, _mm256_fmsub_ps(ur[j], wr, _mm256_mul_ps(ui[j], wi)));
+                _mm256_storeu_ps(outi + q + j * s, _mm256_fmadd_ps(ur[j], wi, _mm256_mul_ps(ui[j], wr)));
+            }
+        }
+    }
+}
+
+// Interleaves rows y0..y3 of eight values as y0[0], y1[0], y2[0], y3[0],
+// y0[1], ... and stores the 32 results at out
+OCEAN_TARGET_AVX2 inline void storeTransposed4x8(float *out, __m256 y0, __m256 y1, __m256 y2, __m256 y3)
+{
+    __m256 t0 = _mm256_unpacklo_ps(y0, y1), t1 = _mm256_unpackhi_ps(y0, y1);
+    __m256 t2 = _mm256_unpacklo_ps(y2, y3), t3 = _mm256_unpackhi_ps(y2, y3);
+    __m256 u0 = _mm256_shuffle_ps(t0, t2, 0x44), u1 = _mm256_shuffle_ps(t0, t2, 0xee);
+    __m256 u2 = _mm256_shuffle_ps(t1, t3, 0x44), u3 = _mm256_shuffle_ps(t1, t3, 0xee);
+    _mm256_storeu_ps(out, _mm256_permute2f128_ps(u0, u1, 0x20));
+    _mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(u2, u3, 0x20));
+    _mm256_storeu_ps(out + 16, _mm256_permute2f128_ps(u0, u1, 0x31));
+    _mm256_storeu_ps(out + 24, _mm256_permute2f128_ps(u2, u3, 0x31));
+}
+
+// First Stockham pass, where s = 1 leaves nothing to vectorize over q.
+// Runs eight values of p at a time instead and interleaves the four
+// outputs of each. m must be a multiple of 8.
+OCEAN_TARGET_AVX2
+void stockham4FirstAVX2(const float *xr, const float *xi, float *yr, float *yi, int m,
+                        const float *tw)
+{
+    const float *w1r = tw, *w1i = tw + m;
+    const float *w2r = tw + 2 * m, *w2i = tw + 3 * m;
+    const float *w3r = tw + 4 * m, *w3i = tw + 5 * m;
+    for (int p = 0; p < m; p += 8) {
+        __m256 xar = _mm256_loadu_ps(xr + p), xai = _mm256_loadu_ps(xi + p);
+        __m256 xbr = _mm256_loadu_ps(xr + p + m), xbi = _mm256_loadu_ps(xi + p + m);
+        __m256 xcr = _mm256_loadu_ps(xr + p + 2 * m), xci = _mm256_loadu_ps(xi + p + 2 * m);
+        __m256 xdr = _mm256_loadu_ps(xr + p + 3 * m), xdi = _mm256_loadu_ps(xi + p + 3 * m);
+        __m256 apcr = _mm256_add_ps(xar, xcr), apci = _mm256_add_ps(xai, xci);
+        __m256 amcr = _mm256_sub_ps(xar, xcr), amci = _mm256_sub_ps(xai, xci);
+        __m256 bpdr = _mm256_add_ps(xbr, xdr), bpdi = _mm256_add_ps(xbi, xdi);
+        __m256 bmdr = _mm256_sub_ps(xbr, xdr), bmdi = _mm256_sub_ps(xbi, xdi);
+        __m256 ur = _mm256_sub_ps(amcr, bmdi), ui = _mm256_add_ps(amci, bmdr);
+        __m256 vr = _mm256_sub_ps(apcr, bpdr), vi = _mm256_sub_ps(apci, bpdi);
+        __m256 tr = _mm256_add_ps(amcr, bmdi), ti = _mm256_sub_ps(amci, bmdr);
+        __m256 wr = _mm256_loadu_ps(w1r + p), wi = _mm256_loadu_ps(w1i + p);
+        __m256 y1r = _mm256_fmsub_ps(ur, wr, _mm256_mul_ps(ui, wi));
+        __m256 y1i = _mm256_fmadd_ps(ur, wi, _mm256_mul_ps(ui, wr));
+        wr = _mm256_loadu_ps(w2r + p); wi = _mm256_loadu_ps(w2i + p);
+        __m256 y2r = _mm256_fmsub_ps(vr, wr, _mm256_mul_ps(vi, wi));
+        __m256 y2i = _mm256_fmadd_ps(vr, wi, _mm256_mul_ps(vi, wr));
+        wr = _mm256_loadu_ps(w3r + p); wi = _mm256_loadu_ps(w3i + p);
+        __m256 y3r = _mm256_fmsub_ps(tr, wr, _mm256_mul_ps(ti, wi));
+        __m256 y3i = _mm256_fmadd_ps(tr, wi, _mm256_mul_ps(ti, wr));
+        storeTransposed4x8(yr + 4 * p, _mm256_add_ps(apcr, bpdr), y1r, y2r, y3r);
+        storeTransposed4x8(yi + 4 * p, _mm256_add_ps(apci, bpdi), y1i, y2i, y3i);
+    }
+}
+
+#endif
+
+// sin and cos usable in constant expressions, for the tables of Fft<N>.
+// A Taylor series after reducing x to [-PI, PI], exact to double precision
+// on that range.
+constexpr double constexprSin(double x)
+{
+    while (x > PI)
+        x -= 2.0 * PI;
+    while (x < -PI)
+        x += 2.0 * PI;
+    double term = x, sum = x;
+    for (int i = 1; i < 16; ++i) {
+        term *= -x * x / ((2 * i) * (2 * i + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double constexprCos(double x)
+{
+    return constexprSin(x + 0.5 * PI);
+}
+
+constexpr int constexprLog2(int n)
+{
+    int len = 0;
+    while ((1 << len) < n)
+        ++len;
+    return len;
+}
+
+// Everything Fft<N> looks up, computed at compile time
+template <int N>
+struct FixedTables
+{
+    static constexpr int Log2 = constexprLog2(N);
+    // Points of the codelet, chosen so that an even number of radix-2
+    // levels is left for the radix-4 passes, preferring the largest that
+    // still leaves eight blocks for the AVX2 codelets
+    static constexpr int Codelet = Log2 % 2 == 1 ? 8 : N >= 128 ? 16 : 4;
+    static constexpr int Blocks = N / Codelet;
+    // 6q floats for each radix-4 pass q = Codelet, 4*Codelet, ..., N/4
+    static constexpr int TwiddleCount = 2 * (N - Codelet);
+
+    // Bit reversal of the block index in log2(Blocks) bits. The input of
+    // block b starts at blockRev[b] with a stride of Blocks.
+    int blockRev[Blocks];
+    // Radix-4 twiddles, laid out as in FFTPlan
+    float twiddles[TwiddleCount > 0 ? TwiddleCount : 1];
+};
+
+template <int N>
+constexpr FixedTables<N> makeFixedTables()
+{
+    typedef FixedTables<N> T;
+    T t{};
+    int bits = T::Log2 - constexprLog2(T::Codelet);
+    for (int b = 0; b < T::Blocks; ++b) {
+        int revb = 0;
+        for (int j = 0; j < bits; ++j)
+            revb |= ((b >> j) & 0x1) << (bits - 1 - j);
+        t.blockRev[b] = revb;
+    }
+    int offset = 0;
+    for (int q = T::Codelet; 4 * q <= N; q *= 4) {
+        for (int p = 1; p <= 3; ++p) {
+            for (int j = 0; j < q; ++j) {
+                double theta = 2.0 * PI * p * j / (4 * q);
+                t.twiddles[offset + 2 * (p - 1) * q + j] = (float)constexprCos(theta);
+                t.twiddles[offset + (2 * p - 1) * q + j] = (float)constexprSin(theta);
+            }
+        }
+        offset += 6 * q;
+    }
+    return t;
+}
+
+template <int N>
+struct FixedTablesOf
+{
+    static constexpr FixedTables<N> value = makeFixedTables<N>();
+};
+
+template <int N>
+constexpr FixedTables<N> FixedTablesOf<N>::value;
+
+// DFT of four points in place, in the direction of FFTPlan
+inline void dft4(float &r0, float &i0, float &r1, float &i1, float &r2, float &i2, float &r3, float &i3)
+{
+    float apcr = r0 + r2, apci = i0 + i2;
+    float amcr = r0 - r2, amci = i0 - i2;
+    float bpdr = r1 + r3, bpdi = i1 + i3;
+    float bmdr = r1 - r3, bmdi = i1 - i3;
+    r0 = apcr + bpdr;
+    i0 = apci + bpdi;
+    r1 = amcr - bmdi;
+    i1 = amci + bmdr;
+    r2 = apcr - bpdr;
+    i2 = apci - bpdi;
+    r3 = amcr + bmdi;
+    i3 = amci - bmdr;
+}
+
+// Multiplies (r, i) by (wr, wi) in place
+inline void rotate(float &r, float &i, float wr, float wi)
+{
+    float t = r * wr - i * wi;
+    i = r * wi + i * wr;
+    r = t;
+}
+
+// Natural order DFTs of 4, 8 and 16 points, from in to out, written out
+// without loops. The input is copied to locals first, which the compiler
+// keeps in registers since nothing else can point to them.
+template <int M>
+struct Codelet;
+
+template <>
+struct Codelet<4>
+{
+    static inline void run(const float *inRe, const float *inIm, float *outRe, float *outIm)
+    {
+        float xr[4] = {inRe[0], inRe[1], inRe[2], inRe[3]}, xi[4] = {inIm[0], inIm[1], inIm[2], inIm[3]};
+        dft4(xr[0], xi[0], xr[1], xi[1], xr[2], xi[2], xr[3], xi[3]);
+        std::copy(xr, xr + 4, outRe);
+        std::copy(xi, xi + 4, outIm);
+    }
+};
+
+// Two DFTs of the even and odd points, merged with W = exp(2*PI*i/8)
+template <>
+struct Codelet<8>
+{
+    static inline void run(const float *inRe, const float *inIm, float *outRe, float *outIm)
+    {
+        const float h = 0.707106781186547524f;
+        float xr[8], xi[8];
+        std::copy(inRe, inRe + 8, xr);
+        std::copy(inIm, inIm + 8, xi);
+        dft4(xr[0], xi[0], xr[2], xi[2], xr[4], xi[4], xr[6], xi[6]);
+        dft4(xr[1], xi[1], xr[3], xi[3], xr[5], xi[5], xr[7], xi[7]);
+        // Odd results times W^k: W = h*(1 + i), W^2 = i, W^3 = h*(-1 + i)
+        rotate(xr[3], xi[3], h, h);
+        rotate(xr[7], xi[7], -h, h);
+        float t5r = -xi[5], t5i = xr[5];
+        outRe[0] = xr[0] + xr[1]; outIm[0] = xi[0] + xi[1];
+        outRe[4] = xr[0] - xr[1]; outIm[4] = xi[0] - xi[1];
+        outRe[1] = xr[2] + xr[3]; outIm[1] = xi[2] + xi[3];
+        outRe[5] = xr[2] - xr[3]; outIm[5] = xi[2] - xi[3];
+        outRe[2] = xr[4] + t5r;   outIm[2] = xi[4] + t5i;
+        outRe[6] = xr[4] - t5r;   outIm[6] = xi[4] - t5i;
+        outRe[3] = xr[6] + xr[7]; outIm[3] = xi[6] + xi[7];
+        outRe[7] = xr[6] - xr[7]; outIm[7] = xi[6] - xi[7];
+    }
+};
+
+// Four DFTs of the points 4j + r, each left at 4k + r, then the twiddles
+// W^(rk) with W = exp(2*PI*i/16), and four more DFTs over r. Result l of
+// the DFT at k is output k + 4l.
+template <>
+struct Codelet<16>
+{
+    static inline void run(const float *inRe, const float *inIm, float *outRe, float *outIm)
+    {
+        const float c1 = 0.923879532511286756f, s1 = 0.382683432365089772f;
+        const float h = 0.707106781186547524f;
+        float xr[16], xi[16];
+        std::copy(inRe, inRe + 16, xr);
+        std::copy(inIm, inIm + 16, xi);
+        dft4(xr[0], xi[0], xr[4], xi[4], xr[8], xi[8], xr[12], xi[12]);
+        dft4(xr[1], xi[1], xr[5], xi[5], xr[9], xi[9], xr[13], xi[13]);
+        dft4(xr[2], xi[2], xr[6], xi[6], xr[10], xi[10], xr[14], xi[14]);
+        dft4(xr[3], xi[3], xr[7], xi[7], xr[11], xi[11], xr[15], xi[15]);
+        rotate(xr[5], xi[5], c1, s1);    // W^1
+        rotate(xr[6], xi[6], h, h);      // W^2
+        rotate(xr[7], xi[7], s1, c1);    // W^3
+        rotate(xr[9], xi[9], h, h);      // W^2
+        float t = xr[10];                // W^4 = i
+        xr[10] = -xi[10];
+        xi[10] = t;
+        rotate(xr[11], xi[11], -h, h);   // W^6
+        rotate(xr[13], xi[13], s1, c1);  // W^3
+        rotate(xr[14], xi[14], -h, h);   // W^6
+        rotate(xr[15], xi[15], -c1, -s1); // W^9
+        dft4(xr[0], xi[0], xr[1], xi[1], xr[2], xi[2], xr[3], xi[3]);
+        dft4(xr[4], xi[4], xr[5], xi[5], xr[6], xi[6], xr[7], xi[7]);
+        dft4(xr[8], xi[8], xr[9], xi[9], xr[10], xi[10], xr[11], xi[11]);
+        dft4(xr[12], xi[12], xr[13], xi[13], xr[14], xi[14], xr[15], xi[15]);
+        outRe[0] = xr[0];  outRe[4] = xr[1];  outRe[8] = xr[2];   outRe[12] = xr[3];
+        outRe[1] = xr[4];  outRe[5] = xr[5];  outRe[9] = xr[6];   outRe[13] = xr[7];
+        outRe[2] = xr[8];  outRe[6] = xr[9];  outRe[10] = xr[10]; outRe[14] = xr[11];
+        outRe[3] = xr[12]; outRe[7] = xr[13]; outRe[11] = xr[14]; outRe[15] = xr[15];
+        outIm[0] = xi[0];  outIm[4] = xi[1];  outIm[8] = xi[2];   outIm[12] = xi[3];
+        outIm[1] = xi[4];  outIm[5] = xi[5];  outIm[9] = xi[6];   outIm[13] = xi[7];
+        outIm[2] = xi[8];  outIm[6] = xi[9];  outIm[10] = xi[10]; outIm[14] = xi[11];
+        outIm[3] = xi[12]; outIm[7] = xi[13]; outIm[11] = xi[14]; outIm[15] = xi[15];
+    }
+};
+
+// The radix-4 passes of Fft<N> from q = Q on, unrolled at compile time.
+// Offset is where the twiddles of the pass start.
+template <int N, int Q, int Offset>
+struct FixedPasses
+{
+    static inline void run(float *re, float *im, const float *tw, InstructionSet isa)
+    {
+#ifdef OCEAN_SIMD_X86
+        // Q is at least 4, so the SSE2 kernel always applies
+        if (isa == InstructionSet::AVX2 && Q % 8 == 0)
+            radix4AVX2(re, im, N, Q, tw + Offset);
+        else if (isa != InstructionSet::Scalar)
+            radix4SSE2(re, im, N, Q, tw + Offset);
+        else
+#endif
+            radix4Scalar(re, im, N, Q, tw + Offset);
+        FixedPasses<N, 4 * Q, Offset + 6 * Q>::run(re, im, tw, isa);
+    }
+};
+
+template <int N, int Offset>
+struct FixedPasses<N, N, Offset>
+{
+    static inline void run(float *, float *, const float *, InstructionSet) {}
+};
+
+#ifdef OCEAN_SIMD_X86
+
+// dft4, rotate and the codelets above for eight blocks at a time, one per
+// lane
+OCEAN_TARGET_AVX2 inline void dft4AVX2(__m256 &r0, __m256 &i0, __m256 &r1, __m256 &i1,
+                                       __m256 &r2, __m256 &i2, __m256 &r3, __m256 &i3)
+{
+    __m256 apcr = _mm256_add_ps(r0, r2), apci = _mm256_add_ps(i0, i2);
+    __m256 amcr = _mm256_sub_ps(r0, r2), amci = _mm256_sub_ps(i0, i2);
+    __m256 bpdr = _mm256_add_ps(r1, r3), bpdi = _mm256_add_ps(i1, i3);
+    __m256 bmdr = _mm256_sub_ps(r1, r3), bmdi = _mm256_sub_ps(i1, i3);
+    r0 = _mm256_add_ps(apcr, bpdr);
+    i0 = _mm256_add_ps(apci, bpdi);
+    r1 = _mm256_sub_ps(amcr, bmdi);
+    i1 = _mm256_add_ps(amci, bmdr);
+    r2 = _mm256_sub_ps(apcr, bpdr);
+    i2 = _mm256_sub_ps(apci, bpdi);
+    r3 = _mm256_add_ps(amcr, bmdi);
+    i3 = _mm256_sub_ps(amci, bmdr);
+}
+
+OCEAN_TARGET_AVX2 inline void rotateAVX2(__m256 &r, __m256 &i, float wr, float wi)
+{
+    __m256 vwr = _mm256_set1_ps(wr), vwi = _mm256_set1_ps(wi);
+    __m256 t = _mm256_fmsub_ps(r, vwr, _mm256_mul_ps(i, vwi));
+    i = _mm256_fmadd_ps(r, vwi, _mm256_mul_ps(i, vwr));
+    r = t;
+}
+
+template <int M>
+struct CodeletAVX2;
+
+template <>
+struct CodeletAVX2<4>
+{
+    OCEAN_TARGET_AVX2 static inline void run(__m256 *xr, __m256 *xi, __m256 *yr, __m256 *yi)
+    {
+        dft4AVX2(xr[0], xi[0], xr[1], xi[1], xr[2], xi[2], xr[3], xi[3]);
+        std::copy(xr, xr + 4, yr);
+        std::copy(xi, xi + 4, yi);
+    }
+};
+
+template <>
+struct CodeletAVX2<8>
+{
+    // Natural order DFT of x into y
+    OCEAN_TARGET_AVX2 static inline void run(__m256 *xr, __m256 *xi, __m256 *yr, __m256 *yi)
+    {
+        const float h = 0.707106781186547524f;
+        dft4AVX2(xr[0], xi[0], xr[2], xi[2], xr[4], xi[4], xr[6], xi[6]);
+        dft4AVX2(xr[1], xi[1], xr[3], xi[3], xr[5], xi[5], xr[7], xi[7]);
+        rotateAVX2(xr[3], xi[3], h, h);
+        rotateAVX2(xr[7], xi[7], -h, h);
+        __m256 t5r = _mm256_sub_ps(_mm256_setzero_ps(), xi[5]), t5i = xr[5];
+        yr[0] = _mm256_add_ps(xr[0], xr[1]); yi[0] = _mm256_add_ps(xi[0], xi[1]);
+        yr[4] = _mm256_sub_ps(xr[0], xr[1]); yi[4] = _mm256_sub_ps(xi[0], xi[1]);
+        yr[1] = _mm256_add_ps(xr[2], xr[3]); yi[1] = _mm256_add_ps(xi[2], xi[3]);
+        yr[5] = _mm256_sub_ps(xr[2], xr[3]); yi[5] = _mm256_sub_ps(xi[2], xi[3]);
+        yr[2] = _mm256_add_ps(xr[4], t5r);   yi[2] = _mm256_add_ps(xi[4], t5i);
+        yr[6] = _mm256_sub_ps(xr[4], t5r);   yi[6] = _mm256_sub_ps(xi[4], t5i);
+        yr[3] = _mm256_add_ps(xr[6], xr[7]); yi[3] = _mm256_add_ps(xi[6], xi[7]);
+        yr[7] = _mm256_sub_ps(xr[6], xr[7]); yi[7] = _mm256_sub_ps(xi[6], xi[7]);
+    }
+};
+
+template <>
+struct CodeletAVX2<16>
+{
+    OCEAN_TARGET_AVX2 static inline void run(__m256 *xr, __m256 *xi, __m256 *yr, __m256 *yi)
+    {
+        const float c1 = 0.923879532511286756f, s1 = 0.382683432365089772f;
+        const float h = 0.707106781186547524f;
+        dft4AVX2(xr[0], xi[0], xr[4], xi[4], xr[8], xi[8], xr[12], xi[12]);
+        dft4AVX2(xr[1], xi[1], xr[5], xi[5], xr[9], xi[9], xr[13], xi[13]);
+        dft4AVX2(xr[2], xi[2], xr[6], xi[6], xr[10], xi[10], xr[14], xi[14]);
+        dft4AVX2(xr[3], xi[3], xr[7], xi[7], xr[11], xi[11], xr[15], xi[15]);
+        rotateAVX2(xr[5], xi[5], c1, s1);
+        rotateAVX2(xr[6], xi[6], h, h);
+        rotateAVX2(xr[7], xi[7], s1, c1);
+        rotateAVX2(xr[9], xi[9], h, h);
+        __m256 t = xr[10];
+        xr[10] = _mm256_sub_ps(_mm256_setzero_ps(), xi[10]);
+        xi[10] = t;
+        rotateAVX2(xr[11], xi[11], -h, h);
+        rotateAVX2(xr[13], xi[13], s1, c1);
+        rotateAVX2(xr[14], xi[14], -h, h);
+        rotateAVX2(xr[15], xi[15], -c1, -s1);
+        for (int k = 0; k < 4; ++k) {
+            __m256 *r = xr + 4 * k, *i = xi + 4 * k;
+            dft4AVX2(r[0], i[0], r[1], i[1], r[2], i[2], r[3], i[3]);
+            for (int l = 0; l < 4; ++l) {
+                yr[k + 4 * l] = r[l];
+                yi[k + 4 * l] = i[l];
+            }
+        }
+    }
+};
+
+// Transposes eight rows of eight floats in place
+OCEAN_TARGET_AVX2 inline void transpose8x8(__m256 *rows)
+{
+    __m256 t[8], u[8];
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_ps(rows[i], rows[i + 1]);
+        t[i + 1] = _mm256_unpackhi_ps(rows[i], rows[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4) {
+        u[i] = _mm256_shuffle_ps(t[i], t[i + 2], 0x44);
+        u[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], 0xee);
+        u[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0x44);
+        u[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0xee);
+    }
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = _mm256_permute2f128_ps(u[i], u[i + 4], 0x20);
+        rows[i + 4] = _mm256_permute2f128_ps(u[i], u[i + 4], 0x31);
+    }
+}
+
+// The codelets of Fft<N> for eight blocks at a time. Eight consecutive
+// input offsets are contiguous in memory, so the lanes are the blocks
+// whose input starts at c..c+7, and each lane is stored to the block that
+// starts there: blockRev is its own inverse. Blocks must be a multiple of 8.
+template <int N, bool Interleaved>
+OCEAN_TARGET_AVX2 void fixedCodeletsAVX2(const float *inRe, const float *inIm, float *re, float *im)
+{
+    typedef FixedTables<N> T;
+    const int C = T::Codelet;
+    const FixedTables<N> &tables = FixedTablesOf<N>::value;
+    for (int c = 0; c < T::Blocks; c += 8) {
+        __m256 xr[C], xi[C], yr[C], yi[C];
+        for (int u = 0; u < C; ++u) {
+            int index = c + T::Blocks * u;
+            if (Interleaved) {
+                // Eight complex values, deinterleaved into lane order
+                __m256 lo = _mm256_loadu_ps(inRe + 2 * index), hi = _mm256_loadu_ps(inRe + 2 * index + 8);
+                xr[u] = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(lo, hi, 0x88)), 0xd8));
+                xi[u] = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(lo, hi, 0xdd)), 0xd8));
+            } else {
+                xr[u] = _mm256_loadu_ps(inRe + index);
+                xi[u] = _mm256_loadu_ps(inIm + index);
+            }
+        }
+        CodeletAVX2<C>::run(xr, xi, yr, yi);
+        if (C == 4) {
+            // Four outputs per lane, transposed as halves of 8x8 tiles
+            __m256 tr[8] = {yr[0], yr[1], yr[2], yr[3], yi[0], yi[1], yi[2], yi[3]};
+            transpose8x8(tr);
+            for (int l = 0; l < 8; ++l) {
+                int b = tables.blockRev[c + l];
+                _mm_storeu_ps(re + b * C, _mm256_castps256_ps128(tr[l]));
+                _mm_storeu_ps(im + b * C, _mm256_extractf128_ps(tr[l], 1));
+            }
+            continue;
+        }
+        for (int k = 0; k < C; k += 8) {
+            transpose8x8(yr + k);
+            transpose8x8(yi + k);
+            for (int l = 0; l < 8; ++l) {
+                int b = tables.blockRev[c + l];
+                _mm256_storeu_ps(re + b * C + k, yr[k + l]);
+                _mm256_storeu_ps(im + b * C + k, yi[k + l]);
+            }
+        }
+    }
+}
+
+#endif
+
+// Fft<N> from inRe[i * Step] and inIm[i * Step]
+template <int N, bool Interleaved>
+void fixedTransform(const float *inRe, const float *inIm, float *re, float *im, InstructionSet isa)
+{
+    typedef FixedTables<N> T;
+    const int C = T::Codelet;
+    const int Step = Interleaved ? 2 : 1;
+    const FixedTables<N> &tables = FixedTablesOf<N>::value;
+#ifdef OCEAN_SIMD_X86
+    if (isa == InstructionSet::AVX2 && T::Blocks % 8 == 0) {
+        fixedCodeletsAVX2<N, Interleaved>(inRe, inIm, re, im);
+        FixedPasses<N, C, 0>::run(re, im, tables.twiddles, isa);
+        return;
+    }
+#endif
+    // After the bit-reverse permutation, block b would hold the points
+    // blockRev[b] + Blocks*u in bit-reversed order of u, and the first
+    // log2(C) passes would turn them into their DFT in natural order
+    for (int b = 0; b < T::Blocks; ++b) {
+        float xr[C], xi[C];
+        int base = tables.blockRev[b];
+        for (int u = 0; u < C; ++u) {
+            xr[u] = inRe[(base + T::Blocks * u) * Step];
+            xi[u] = inIm[(base + T::Blocks * u) * Step];
+        }
+        Codelet<C>::run(xr, xi, re + b * C, im + b * C);
+    }
+    FixedPasses<N, C, 0>::run(re, im, tables.twiddles, isa);
+}
+
+// Side of the square tiles the transposes work on. Two 32x32 tiles of
+// complex floats take 16 KB, which leaves room in L1 for the rows.
+const int TransposeBlock = 32;
+
+// Split scratch for the interleaved entry points, holding count complex
+// values as separate real and imaginary arrays. Each thread grows its own
+// buffer once and reuses it, so plans stay const and thread-safe.
+float *splitScratch(int count)
+{
+    static thread_local std::vector<float, AlignedAllocator<float>> scratch;
+    if ((int)scratch.size() < 2 * count)
+        scratch.resize(2 * count);
+    return scratch.data();
+}
+
+// Runs f over [0, count) on the pool's threads, or inline without a pool
+template <typename F>
+void forRanges(ThreadPool *pool, int count, F &&f)
+{
+    if (pool)
+        pool->parallelFor(count, f);
+    else if (count > 0)
+        f(0, count);
+}
+
+// Swaps the tile at (bi, bj) of an n*n array with its transpose at (bj, bi).
+// Tiles are copied out whole before being written back, so each cache line
+// is read and written once even when the power-of-two row stride maps
+// every row of a tile to the same cache set.
+void transposeTiles(std::complex<float> *data, int n, int bi, int bj)
+{
+    std::complex<float> a[TransposeBlock * TransposeBlock], b[TransposeBlock * TransposeBlock];
+    int h = std::min(TransposeBlock, n - bi);
+    int w = std::min(TransposeBlock, n - bj);
+    for (int i = 0; i < h; ++i)
+        for (int j = 0; j < w; ++j)
+            a[j * TransposeBlock + i] = data[(bi + i) * n + bj + j];
+    if (bi == bj) {
+        for (int i = 0; i < h; ++i)
+            for (int j = 0; j < w; ++j)
+                data[(bi + i) * n + bj + j] = a[i * TransposeBlock + j];
+        return;
+    }
+    for (int j = 0; j < w; ++j)
+        for (int i = 0; i < h; ++i)
+            b[i * TransposeBlock + j] = data[(bj + j) * n + bi + i];
+    for (int j = 0; j < w; ++j)
+        for (int i = 0; i < h; ++i)
+            data[(bj + j) * n + bi + i] = a[j * TransposeBlock + i];
+    for (int i = 0; i < h; ++i)
+        for (int j = 0; j < w; ++j)
+            data[(bi + i) * n + bj + j] = b[i * TransposeBlock + j];
+}
+
+// Scratch for the transposed half spectrum of RealFFTPlan::transform2D
+std::complex<float> *transposeScratch(int size)
+{
+    static thread_local std::vector<std::complex<float>, AlignedAllocator<std::complex<float>>> scratch;
+    if ((int)scratch.size() < size)
+        scratch.resize(size);
+    return scratch.data();
+}
+
+}
+
+template <int N>
+void Fft<N>::transform(const std::complex<float> *a, float *re, float *im, InstructionSet isa)
+{
+    auto *in = reinterpret_cast<const float *>(a);
+    fixedTransform<N, true>(in, in + 1, re, im, isa);
+}
+
+template <int N>
+void Fft<N>::transformSplit(const float *inRe, const float *inIm, float *re, float *im,
+                            InstructionSet isa)
+{
+    fixedTransform<N, false>(inRe, inIm, re, im, isa);
+}
+
+template struct Fft<64>;
+template struct Fft<128>;
+template struct Fft<256>;
+template struct Fft<512>;
+template struct Fft<1024>;
+
+namespace {
+
+// Dispatch table of the specializations above, in the order of FixedFFTSizes
+struct FixedEntry
+{
+    int n;
+    void (*transform)(const std::complex<float> *, float *, float *, InstructionSet);
+    void (*transformSplit)(const float *, const float *, float *, float *, InstructionSet);
+};
+
+const FixedEntry FixedEntries[] = {
+        {64, Fft<64>::transform, Fft<64>::transformSplit},
+        {128, Fft<128>::transform, Fft<128>::transformSplit},
+        {256, Fft<256>::transform, Fft<256>::transformSplit},
+        {512, Fft<512>::transform, Fft<512>::transformSplit},
+        {1024, Fft<1024>::transform, Fft<1024>::transformSplit},
+};
+
+static_assert(sizeof(FixedEntries) / sizeof(FixedEntries[0]) == sizeof(FixedFFTSizes) / sizeof(FixedFFTSizes[0]),
+              "every size of FixedFFTSizes needs an entry");
+
+}
+
+void reserveScratch(int n, ThreadPool *pool)
+{
+    // With as many ranges as threads, every thread gets exactly one.
+    // Stockham plans need a second pair of arrays to ping-pong with.
+    forRanges(pool, pool ? pool->size() : 1, [=](int, int) {
+        splitScratch(2 * n);
+    });
+}
+
+void transposeSquare(std::complex<float> *data, int n, ThreadPool *pool)
+{
+    // Work is split over the tile pairs (bi, bj), bj >= bi, in row order,
+    // so every thread swaps about the same number of tiles
+    int tiles = (n + TransposeBlock - 1) / TransposeBlock;
+    forRanges(pool, tiles * (tiles + 1) / 2, [=](int begin, int end) {
+        int ti = 0, tj = begin;
+        while (tj >= tiles - ti) {
+            tj -= tiles - ti;
+            ++ti;
+        }
+        tj += ti;
+        for (int pair = begin; pair < end; ++pair) {
+            transposeTiles(data, n, ti * TransposeBlock, tj * TransposeBlock);
+            if (++tj == tiles) {
+                ++ti;
+                tj = ti;
+            }
+        }
+    });
+}
+
+void transpose(const std::complex<float> *in, std::complex<float> *out, int rows, int cols,
+               ThreadPool *pool)
+{
+    // Every thread writes its own band of output rows
+    int bands = (cols + TransposeBlock - 1) / TransposeBlock;
+    forRanges(pool, bands, [=](int begin, int end) {
+        for (int bj = begin * TransposeBlock; bj < std::min(end * TransposeBlock, cols); bj += TransposeBlock) {
+            int jEnd = std::min(bj + TransposeBlock, cols);
+            for (int bi = 0; bi < rows; bi += TransposeBlock) {
+                int iEnd = std::min(bi + TransposeBlock, rows);
+                for (int i = bi; i < iEnd; ++i)
+                    for (int j = bj; j < jEnd; ++j)
+                        out[j * rows + i] = in[i * cols + j];
+            }
+        }
+    });
+}
+
+FFTPlan::FFTPlan(int n, InstructionSet isa, FFTAlgorithm algorithm)
+        : n(n), isa(resolveInstructionSet(isa)), method(algorithm),
+          fixedTransform(nullptr), fixedTransformSplit(nullptr)
+{
+    // n = 2^twos * 3^threes * 5^fives
+    int twos = 0, threes = 0, fives = 0, rest = n;
+    for (; rest > 1 && rest % 2 == 0; rest /= 2) ++twos;
+    for (; rest > 1 && rest % 3 == 0; rest /= 3) ++threes;
+    for (; rest > 1 && rest % 5 == 0; rest /= 5) ++fives;
+    if (n < 1 || rest != 1)
+        throw std::invalid_argument("FFTPlan: size must have no prime factors other than 2, 3 and 5");
+    // Bit reversal only exists for powers of two
+    if (threes + fives > 0)
+        method = FFTAlgorithm::Stockham;
+    if (method == FFTAlgorithm::Auto) {
+        method = FFTAlgorithm::CooleyTukey;
+        for (const FixedEntry &entry : FixedEntries) {
+            if (entry.n == n) {
+                // Fft<n> carries its own tables, the plan needs none
+                fixedTransform = entry.transform;
+                fixedTransformSplit = entry.transformSplit;
+                return;
+            }
+        }
+    }
+
+    auto addStage = [this](int radix, int q) {
+        stages.push_back({radix, q, twiddles.size()});
+        // Evaluate every twiddle directly instead of accumulating w = w * wm,
+        // which drifts for large n
+        size_t offset = twiddles.size();
+        twiddles.resize(offset + 2 * (radix - 1) * q);
+        for (int p = 1; p < radix; ++p) {
+            float *wr = &twiddles[offset + 2 * (p - 1) * q], *wi = wr + q;
+            for (int j = 0; j < q; ++j) {
+                double theta = 2.0 * PI * p * j / (radix * q);
+                wr[j] = (float)std::cos(theta);
+                wi[j] = (float)std::sin(theta);
+            }
+        }
+    };
+
+    if (method == FFTAlgorithm::Stockham) {
+        // Radix-4 passes first and the odd radices after them, where the
+        // stride has grown wide enough to vectorize over. A radix-2 pass
+        // comes last, where it needs no twiddles.
+        int size = n;
+        auto addPasses = [&](int radix, int count) {
+            for (int i = 0; i < count; ++i) {
+                size /= radix;
+                addStage(radix, size);
+            }
+        };
+        addPasses(4, twos / 2);
+        addPasses(3, threes);
+        addPasses(5, fives);
+        if (twos % 2 == 1)
+            stages.push_back({2, 1, 0});
+        return;
+    }
+
+    rev.resize(n);
+    for (int i = 0; i < n; ++i) {
+        // 0b001 -> 0b100
+        int revi = 0;
+        for (int j = 0; j < twos; ++j)
+            revi |= ((i >> j) & 0x1) << (twos - 1 - j);
+        rev[i] = revi;
+    }
+
+    int q = 1;
+    if (twos % 2 == 1) {
+        stages.push_back({2, 1, 0});
+        q = 2;
+    }
+    for (; 4 * q <= n; q *= 4)
+        addStage(4, q);
+}
+
+void FFTPlan::transform(const std::complex<float> *a, std::complex<float> *A) const
+{
+    if (method == FFTAlgorithm::Stockham) {
+        float *re = splitScratch(2 * n), *im = re + n, *workRe = im + n, *workIm = workRe + n;
+        for (int i = 0; i < n; ++i) {
+            re[i] = a[i].real();
+            im[i] = a[i].imag();
+        }
+        if (autosort(re, im, workRe, workIm)) {
+            re = workRe;
+            im = workIm;
+        }
+        for (int i = 0; i < n; ++i)
+            A[i] = std::complex<float>(re[i], im[i]);
+        return;
+    }
+
+    float *re = splitScratch(n), *im = re + n;
+    if (fixedTransform) {
+        fixedTransform(a, re, im, isa);
+    } else {
+        // rev is its own inverse, so gathering a[rev[i]] performs the
+        // permutation while reading the input
+        for (int i = 0; i < n; ++i) {
+            re[i] = a[rev[i]].real();
+            im[i] = a[rev[i]].imag();
+        }
+        butterflies(re, im);
+    }
+    for (int i = 0; i < n; ++i)
+        A[i] = std::complex<float>(re[i], im[i]);
+}
+
+void FFTPlan::transform(std::complex<float> *data) const
+{
+    // Both read all of their input before writing any output
+    if (method == FFTAlgorithm::Stockham || fixedTransform) {
+        transform(data, data);
+        return;
+    }
+
+    float *re = splitScratch(n), *im = re + n;
+    for (int i = 0; i < n; ++i) {
+        re[i] = data[rev[i]].real();
+        im[i] = data[rev[i]].imag();
+    }
+    butterflies(re, im);
+    for (int i = 0; i < n; ++i)
+        data[i] = std::complex<float>(re[i], im[i]);
+}
+
+void FFTPlan::transform(float *re, float *im) const
+{
+    if (method == FFTAlgorithm::Stockham) {
+        float *workRe = splitScratch(n), *workIm = workRe + n;
+        if (autosort(re, im, workRe, workIm)) {
+            std::copy(workRe, workRe + n, re);
+            std::copy(workIm, workIm + n, im);
+        }
+        return;
+    }
+
+    if (fixedTransformSplit) {
+        float *inRe = splitScratch(n), *inIm = inRe + n;
+        std::copy(re, re + n, inRe);
+        std::copy(im, im + n, inIm);
+        fixedTransformSplit(inRe, inIm, re, im, isa);
+        return;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (i < rev[i]) {
+            std::swap(re[i], re[rev[i]]);
+            std::swap(im[i], im[rev[i]]);
+        }
+    }
+    butterflies(re, im);
+}
+
+void FFTPlan::butterflies(float *re, float *im) const
+{
+    for (const Stage &stage : stages) {
+        if (stage.radix == 2) {
+            radix2Scalar(re, im, n);
+            continue;
+        }
+        const float *tw = twiddles.data() + stage.twiddleOffset;
+#ifdef OCEAN_SIMD_X86
+        if (isa == InstructionSet::AVX2 && stage.q % 8 == 0) {
+            radix4AVX2(re, im, n, stage.q, tw);
+            continue;
+        }
+        if (isa != InstructionSet::Scalar && stage.q % 4 == 0) {
+            radix4SSE2(re, im, n, stage.q, tw);
+            continue;
+        }
+#endif
+        radix4Scalar(re, im, n, stage.q, tw);
+    }
+}
+
+bool FFTPlan::autosort(float *re, float *im, float *workRe, float *workIm) const
+{
+    float *xr = re, *xi = im, *yr = workRe, *yi = workIm;
+    // Stride between the interleaved transforms of the current pass
+    int s = 1;
+    for (const Stage &stage : stages) {
+        const float *tw = twiddles.data() + stage.twiddleOffset;
+#ifdef OCEAN_SIMD_X86
+        bool avx2 = isa == InstructionSet::AVX2 && s % 8 == 0;
+#else
+        bool avx2 = false;
+#endif
+        switch (stage.radix) {
+            case 2:
+                stockham2Scalar(xr, xi, yr, yi, s);
+                break;
+            case 3:
+#ifdef OCEAN_SIMD_X86
+                if (avx2) {
+                    stockham3AVX2(xr, xi, yr, yi, stage.q, s, tw);
+                    break;
+                }
+#endif
+                stockham3Scalar(xr, xi, yr, yi, stage.q, s, tw);
+                break;
+            case 5:
+#ifdef OCEAN_SIMD_X86
+                if (avx2) {
+                    stockham5AVX2(xr, xi, yr, yi, stage.q, s, tw);
+                    break;
+                }
+#endif
+                stockham5Scalar(xr, xi, yr, yi, stage.q, s, tw);
+                break;
+            default:
+#ifdef OCEAN_SIMD_X86
+                if (avx2) {
+                    stockham4AVX2(xr, xi, yr, yi, stage.q, s, tw);
+                    break;
+                }
+                if (isa == InstructionSet::AVX2 && s == 1 && stage.q % 8 == 0) {
+                    stockham4FirstAVX2(xr, xi, yr, yi, stage.q, tw);
+                    break;
+                }
+                if (isa != InstructionSet::Scalar && s % 4 == 0) {
+                    stockham4SSE2(xr, xi, yr, yi, stage.q, s, tw);
+                    break;
+                }
+#endif
+                stockham4Scalar(xr, xi, yr, yi, stage.q, s, tw);
+                break;
+        }
+        std::swap(xr, yr);
+        std::swap(xi, yi);
+        s *= stage.radix;
+    }
+    return xr == workRe;
+}
+
+void FFTPlan::transform2D(std::complex<float> *data, ThreadPool *pool) const
+{
+    auto rows = [=](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            transform(data + i * n);
+    };
+
+    // First round of FFT on rows
+    forRanges(pool, n, rows);
+
+    // Second round on columns, which are rows again after a transpose.
+    // This keeps every pass at unit stride instead of walking columns.
+    transposeSquare(data, n, pool);
+    forRanges(pool, n, rows);
+    transposeSquare(data, n, pool);
+}
+
+RealFFTPlan::RealFFTPlan(int n)
+        : n(n), full(n), half(n / 2), twiddles(n / 2)
+{
+    if (n < 2 || n % 2 != 0)
+        throw std::invalid_argument("RealFFTPlan: size must be even");
+
+    for (int k = 0; k < n / 2; ++k) {
+        double theta = 2.0 * PI * k / n;
+        twiddles[k] = std::complex<float>((float)std::cos(theta), (float)std::sin(theta));
+    }
+}
+
+void RealFFTPlan::transform(std::complex<float> *data) const
+{
+    // Split x into even and odd samples and compute z[j] = x[2j] + i*x[2j+1]
+    // with one n/2-point transform of
+    //   Z[k] = (X[k] + X[k+n/2]) + i*(X[k] - X[k+n/2])*exp(2*PI*i*k/n)
+    // where X[k+n/2] = conj(X[n/2-k]) by symmetry. Z[k] and Z[n/2-k] read
+    // the same two inputs, so the pairs are rewritten in place.
+    // Written out in floats, since std::complex multiplication goes through
+    // a slow NaN-checking library call with most compilers
+    auto z = [this](std::complex<float> a, std::complex<float> b, int k) {
+        float sr = a.real() + b.real(), si = a.imag() + b.imag();
+        float dr = a.real() - b.real(), di = a.imag() - b.imag();
+        float wr = twiddles[k].real(), wi = twiddles[k].imag();
+        float tr = dr * wr - di * wi, ti = dr * wi + di * wr;
+        return std::complex<float>(sr - ti, si + tr);
+    };
+    int h = n / 2;
+    for (int k = 0; k <= h / 2; ++k) {
+        int k2 = h - k;
+        auto a = data[k], b = std::conj(data[k2]);
+        if (k2 < h && k2 != k)
+            data[k2] = z(data[k2], std::conj(a), k2);
+        data[k] = z(a, b, k);
+    }
+    // The complex result interleaves exactly as x[0], x[1], ..., x[n-1]
+    half.transform(data);
+}
+
+void RealFFTPlan::transform2D(std::complex<float> *data, ThreadPool *pool,
+                              std::complex<float> *scratch) const
+{
+    int h = halfSize();
+    std::complex<float> *columns = scratch ? scratch : transposeScratch(scratchSize());
+
+    // Columns first, over the half spectrum only. Every row of the
+    // result is still Hermitian symmetric. The half spectrum is not
+    // square, so its columns are transposed through a scratch buffer.
+    transpose(data, columns, n, h, pool);
+    forRanges(pool, h, [=](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            full.transform(columns + i * n);
+    });
+    transpose(columns, data, h, n, pool);
+
+    // Then one complex-to-real transform per row
+    forRanges(pool, n, [=](int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            transform(data + i * h);
+    });
+}
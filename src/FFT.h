@@ -0,0 +1,208 @@
+//
+// Plan-based FFT engine shared by the ocean simulators
+//
+// A plan precomputes everything that only depends on the transform size
+// (twiddle factors and the bit-reverse permutation), so it can be created
+// once and reused across frames. Transforms never modify the plan, so one
+// plan may be used from several threads at the same time.
+//
+
+#ifndef PROJECT_FFT_H
+#define PROJECT_FFT_H
+
+#include <complex>
+#include <vector>
+#include <cstddef>
+
+#include "SIMD.h"
+
+class ThreadPool;
+
+// How a plan orders its butterfly passes
+enum class FFTAlgorithm
+{
+    // Fft<n> for the sizes it is compiled for, Cooley-Tukey for other powers
+    // of two and Stockham for the rest
+    Auto,
+    // Permutes the input into bit-reversed order, then runs every pass in
+    // place. The permutation is a scattered gather over the whole row.
+    CooleyTukey,
+    // Stockham autosort: every pass reads one buffer and writes the other
+    // at unit stride, leaving the result in natural order without any
+    // permutation, at the cost of a second buffer
+    Stockham,
+};
+
+class FFTPlan
+{
+public:
+    // n must have no prime factors other than 2, 3 and 5. Sizes that are
+    // not powers of two always use the Stockham algorithm. isa selects the
+    // butterfly kernels, Auto picks the widest instruction set the CPU
+    // supports.
+    explicit FFTPlan(int n, InstructionSet isa = InstructionSet::Auto,
+                     FFTAlgorithm algorithm = FFTAlgorithm::Auto);
+
+    int size() const { return n; }
+
+    // The instruction set the butterflies actually run with
+    InstructionSet instructionSet() const { return isa; }
+
+    FFTAlgorithm algorithm() const { return method; }
+
+    // Whether transforms run through the compile-time specialized Fft<n>
+    bool specialized() const { return fixedTransform != nullptr; }
+
+    // Computes A[k] = sum(a[j] * exp(2*PI*i*j*k/n)) without normalization,
+    // which is the direction the ocean uses to go from spectrum to space.
+    // a and A must not overlap.
+    void transform(const std::complex<float> *a, std::complex<float> *A) const;
+
+    // In-place version of the transform above
+    void transform(std::complex<float> *data) const;
+
+    // In-place transform of data stored as separate real and imaginary
+    // arrays, which is the layout the butterfly kernels work on
+    void transform(float *re, float *im) const;
+
+    // Transforms every row and then every column of an n*n row-major array.
+    // Columns are transformed as rows between two tiled transposes. With a
+    // pool, rows and tiles are split across its threads; the result does
+    // not depend on the number of threads.
+    void transform2D(std::complex<float> *data, ThreadPool *pool = nullptr) const;
+
+private:
+    int n;
+    InstructionSet isa;
+    FFTAlgorithm method;
+    // rev[i] is the bit reversal of i in log2(n) bits, Cooley-Tukey only
+    std::vector<int> rev;
+
+    // Cooley-Tukey passes run after the bit-reverse permutation. A radix-2
+    // pass only appears first, when log2(n) is odd. A radix-4 pass merges
+    // four transforms of size q into one of size 4q.
+    // Stockham passes run in the opposite order: a radix-r pass splits
+    // transforms of size r*q into r of size q. Radix-4 passes come first,
+    // then the radix-3 and radix-5 ones, and a radix-2 pass only appears
+    // last.
+    struct Stage
+    {
+        int radix;
+        int q;
+        size_t twiddleOffset;
+    };
+    std::vector<Stage> stages;
+    // Twiddles of every pass but the radix-2 ones, evaluated in double
+    // precision. With W = exp(2*PI*i/(r*q)) a radix-r pass stores the q
+    // values of W^j, W^2j, ..., W^(r-1)j as separate real and imaginary
+    // arrays.
+    std::vector<float, AlignedAllocator<float>> twiddles;
+
+    // Butterfly passes over split data that is already in bit-reversed order
+    void butterflies(float *re, float *im) const;
+
+    // Fft<n>::transform and Fft<n>::transformSplit, when n has a
+    // specialization and the plan was created with FFTAlgorithm::Auto
+    void (*fixedTransform)(const std::complex<float> *a, float *re, float *im, InstructionSet isa);
+    void (*fixedTransformSplit)(const float *inRe, const float *inIm, float *re, float *im,
+                                InstructionSet isa);
+
+    // Stockham passes ping-ponging between (re, im) and the work arrays.
+    // Returns true when the result ended up in the work arrays.
+    bool autosort(float *re, float *im, float *workRe, float *workIm) const;
+};
+
+/*
+ * Cooley-Tukey transform of a size fixed at compile time. The stage count,
+ * twiddles and bit-reverse table are constexpr. The first two to four
+ * radix-2 levels run as one fully unrolled codelet per block, which also
+ * absorbs the bit-reverse permutation into its loads, and the remaining
+ * radix-4 passes are unrolled by template recursion. With AVX2 the
+ * codelets run on eight blocks at a time.
+ *
+ * Only defined for the sizes in FixedFFTSizes, which FFTPlan picks up
+ * automatically.
+ */
+template <int N>
+struct Fft
+{
+    // Same transform as FFTPlan, from interleaved input to the result as
+    // separate real and imaginary arrays. isa must be resolved already.
+    static void transform(const std::complex<float> *a, float *re, float *im, InstructionSet isa);
+
+    // Same from split input. The input and output must not overlap.
+    static void transformSplit(const float *inRe, const float *inIm, float *re, float *im,
+                               InstructionSet isa);
+};
+
+// The ocean resolutions Fft<N> is compiled for
+const int FixedFFTSizes[] = {64, 128, 256, 512, 1024};
+
+/*
+ * Complex-to-real transforms for spectra with Hermitian symmetry,
+ * X[-k] = conj(X[k]). The result of such a transform is purely real, so
+ * only the non-negative half of the last dimension has to be stored and
+ * each transform costs about half of the complex one.
+ */
+class RealFFTPlan
+{
+public:
+    // n must be even and a valid FFTPlan size
+    explicit RealFFTPlan(int n);
+
+    int size() const { return n; }
+
+    // Number of complex values stored for each row of a half spectrum
+    int halfSize() const { return n / 2 + 1; }
+
+    // In-place complex-to-real transform of one row. data holds the n/2+1
+    // values X[0..n/2] on entry and the n real samples on return.
+    void transform(std::complex<float> *data) const;
+
+    // Number of complex values of scratch transform2D works through
+    int scratchSize() const { return n * halfSize(); }
+
+    // In-place complex-to-real transform of an n*n field. data holds n
+    // rows of n/2+1 values on entry. On return it holds n rows of n real
+    // samples, each row starting 2*halfSize() floats after the previous one.
+    // The pool is used as in FFTPlan::transform2D. scratch must hold
+    // scratchSize() values, without it a buffer of the calling thread is used.
+    void transform2D(std::complex<float> *data, ThreadPool *pool = nullptr,
+                     std::complex<float> *scratch = nullptr) const;
+
+private:
+    int n;
+    // Transforms along the first dimension, which is stored in full
+    FFTPlan full;
+    // The real rows are computed as complex transforms of half the size
+    FFTPlan half;
+    // twiddles[k] = exp(2*PI*i*k/n), k < n/2
+    std::vector<std::complex<float>> twiddles;
+};
+
+// Cache-blocked transposes of row-major complex arrays, used to turn the
+// column passes of the 2D transforms into unit-stride row passes
+void transposeSquare(std::complex<float> *data, int n, ThreadPool *pool = nullptr);
+void transpose(const std::complex<float> *in, std::complex<float> *out, int rows, int cols,
+               ThreadPool *pool = nullptr);
+
+// The interleaved transforms work through a scratch buffer that each thread
+// allocates on first use and reuses afterwards. This sizes it for transforms
+// of up to n points with either algorithm on the calling thread and every
+// thread of the pool, so that later transforms of that size never allocate.
+void reserveScratch(int n, ThreadPool *pool = nullptr);
+
+// How the ocean classes turn their five spectra into spatial fields
+enum class FFTMode
+{
+    // One full complex 2D transform per field
+    Complex,
+    // One complex-to-real 2D transform per field over half of the spectrum
+    Real,
+    // Two real fields a and b share one complex transform of a + i*b, which
+    // leaves a in the real part and b in the imaginary part of the result
+    Packed,
+};
+
+
+#endif //PROJECT_FFT_H
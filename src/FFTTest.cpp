@@ -1,6 +1,7 @@
 //
 // This file is a collection of different FFT implementatons
-// for future reference
+// for future reference, and the tests and benchmarks of the FFT engine
+// measured against them. See main for the command line.
 //
 // Created by 何昊 on 2018/03/14.
 //
@@ -8,11 +9,63 @@
 #include <iostream>
 #include <complex>
 #include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <limits>
+#include <stdexcept>
+
+#include "FFT.h"
+#include "Spectrum.h"
+#include "ThreadPool.h"
+#include "BakedOcean.h"
+#include "OceanFrameCache.h"
+#include "OceanProducer.h"
+#include "OceanQuery.h"
+#include "VertexBufferOcean.h"
 
 using namespace std;
 
 const double PI = 3.1415926f;
 
+// Every heap allocation of the program goes through these, so the tests
+// can check that a frame does not allocate. They are kept out of line, as
+// GCC otherwise inlines them and warns about free() on memory from new.
+atomic<long> allocationCount(0);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TEST_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define TEST_NOINLINE __declspec(noinline)
+#else
+#define TEST_NOINLINE
+#endif
+
+TEST_NOINLINE void *operator new(size_t size)
+{
+    ++allocationCount;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+TEST_NOINLINE void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+TEST_NOINLINE void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
 // The straightforward implementation of FFT
 vector<complex<double>> recursiveFFT(vector<complex<double>> a)
 {
@@ -85,6 +138,8 @@ vector<complex<double>> iterativeFFT(const vector<complex<double>> &a)
     return A;
 }
 
+// Inverse of recursiveFFT. Every level halves its result, which divides
+// the whole transform by n.
 vector<complex<double>> reverseRecursiveFFT(vector<complex<double>> a)
 {
     auto n = a.size();
@@ -101,30 +156,1084 @@ vector<complex<double>> reverseRecursiveFFT(vector<complex<double>> a)
     auto y0 = reverseRecursiveFFT(a0), y1 = reverseRecursiveFFT(a1);
     vector<complex<double>> y(n); // Stores result
     for (int k = 0; k <= n/2 - 1; ++k) {
-        y[k] = (y0[k] + w * y1[k]) / (double)n;
-        y[k + n/2] = (y0[k] - w * y1[k]) / (double)n;
+        y[k] = (y0[k] + w * y1[k]) / 2.0;
+        y[k + n/2] = (y0[k] - w * y1[k]) / 2.0;
         w = w * (1.0/wn);
     }
     return y;
 }
 
-int main()
+// Double precision transform the others are measured against: a radix-2
+// FFT with every twiddle evaluated directly for powers of two, a direct
+// DFT for other sizes
+vector<complex<double>> referenceTransform(const vector<complex<double>> &a)
+{
+    // PI above only has float precision
+    const double twoPi = 2.0 * acos(-1.0);
+    int n = (int)a.size();
+    vector<complex<double>> A(n);
+    if (n & (n - 1)) {
+        vector<complex<double>> roots(n);
+        for (int k = 0; k < n; ++k)
+            roots[k] = polar(1.0, twoPi * k / n);
+        for (int k = 0; k < n; ++k)
+            for (int j = 0; j < n; ++j)
+                A[k] += a[j] * roots[(long long)j * k % n];
+        return A;
+    }
+    int len = 0;
+    while ((1 << len) < n) ++len;
+    for (int i = 0; i < n; ++i) {
+        int revi = 0;
+        for (int j = 0; j < len; ++j)
+            revi |= ((i >> j) & 0x1) << (len - 1 - j);
+        A[revi] = a[i];
+    }
+    for (int m = 2; m <= n; m *= 2) {
+        for (int j = 0; j < m / 2; ++j) {
+            complex<double> w = polar(1.0, twoPi * j / m);
+            for (int k = 0; k < n; k += m) {
+                auto t = w * A[k + j + m / 2];
+                auto u = A[k + j];
+                A[k + j] = u + t;
+                A[k + j + m / 2] = u - t;
+            }
+        }
+    }
+    return A;
+}
+
+// Fills an n*n array with a random spectrum that satisfies X[-k] = conj(X[k])
+void randomHermitian(vector<complex<float>> &X, int n, default_random_engine &generator)
+{
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            int index = i * n + j, mirror = ((n - i) % n) * n + (n - j) % n;
+            if (index < mirror) {
+                X[index] = complex<float>(dist(generator), dist(generator));
+                X[mirror] = conj(X[index]);
+            } else if (index == mirror) {
+                X[index] = dist(generator);
+            }
+        }
+    }
+}
+
+// Checks that every FFTMode gives the same fields as separate complex
+// transforms, which is what the ocean classes did originally
+bool testFFTModes(int n)
+{
+    default_random_engine generator(n);
+    vector<complex<float>> a(n * n), b(n * n);
+    randomHermitian(a, n, generator);
+    randomHermitian(b, n, generator);
+
+    FFTPlan plan(n);
+    RealFFTPlan realPlan(n);
+    int h = realPlan.halfSize();
+
+    // Reference: one complex transform per field
+    auto A = a, B = b;
+    plan.transform2D(A.data());
+    plan.transform2D(B.data());
+
+    // Packed: one complex transform of a + i*b
+    vector<complex<float>> packed(n * n);
+    for (int i = 0; i < n * n; ++i)
+        packed[i] = a[i] + complex<float>(0.0f, 1.0f) * b[i];
+    plan.transform2D(packed.data());
+
+    // Real: one complex-to-real transform of the half spectrum of a
+    vector<complex<float>> half(n * h);
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < h; ++j)
+            half[i * h + j] = a[i * n + j];
+    realPlan.transform2D(half.data());
+    auto *real = reinterpret_cast<float *>(half.data());
+
+    float maxValue = 0.0f, packedError = 0.0f, realError = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            int index = i * n + j;
+            maxValue = max(maxValue, max(abs(A[index].real()), abs(B[index].real())));
+            packedError = max(packedError, abs(packed[index].real() - A[index].real()));
+            packedError = max(packedError, abs(packed[index].imag() - B[index].real()));
+            realError = max(realError, abs(real[i * 2 * h + j] - A[index].real()));
+        }
+    }
+    // Errors grow with log(n) and the magnitude of the result
+    float tolerance = 1e-5f * maxValue * n;
+    bool passed = packedError <= tolerance && realError <= tolerance;
+    cout << "FFT modes at n = " << n << ": packed error " << packedError
+         << ", real error " << realError << (passed ? " (passed)" : " (FAILED)") << endl;
+    return passed;
+}
+
+// Checks the SIMD butterflies, the Stockham passes and the compile-time
+// specialized transforms against the scalar Cooley-Tukey ones
+bool testInstructionSets(int n)
+{
+    default_random_engine generator(n);
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    vector<complex<float>> a(n), reference(n), result(n);
+    for (auto &x : a)
+        x = complex<float>(dist(generator), dist(generator));
+    FFTPlan(n, InstructionSet::Scalar, FFTAlgorithm::CooleyTukey).transform(a.data(), reference.data());
+
+    bool passed = true;
+    for (auto algorithm : {FFTAlgorithm::CooleyTukey, FFTAlgorithm::Stockham, FFTAlgorithm::Auto}) {
+        for (auto isa : {InstructionSet::Scalar, InstructionSet::SSE2, InstructionSet::AVX2}) {
+            FFTPlan plan(n, isa, algorithm);
+            // Out of place, in place and split, which take different paths
+            plan.transform(a.data(), result.data());
+            vector<complex<float>> inPlace = a;
+            plan.transform(inPlace.data());
+            vector<float> re(n), im(n);
+            for (int i = 0; i < n; ++i) {
+                re[i] = a[i].real();
+                im[i] = a[i].imag();
+            }
+            plan.transform(re.data(), im.data());
+            float error = 0.0f;
+            for (int i = 0; i < n; ++i) {
+                error = max(error, abs(result[i] - reference[i]));
+                error = max(error, abs(inPlace[i] - reference[i]));
+                error = max(error, abs(complex<float>(re[i], im[i]) - reference[i]));
+            }
+            if (error > 1e-5f * n) {
+                cout << (plan.specialized() ? "Fft<N>" :
+                         algorithm == FFTAlgorithm::Stockham ? "Stockham" : "Cooley-Tukey")
+                     << " FFT with " << instructionSetName(plan.instructionSet()) << " at n = " << n
+                     << " differs from scalar by " << error << " (FAILED)" << endl;
+                passed = false;
+            }
+        }
+    }
+    return passed;
+}
+
+// Checks the mixed-radix transforms of sizes that are not powers of two
+// against a direct DFT in double precision
+bool testMixedRadix(int n)
+{
+    default_random_engine generator(n);
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    vector<complex<float>> a(n), result(n);
+    for (auto &x : a)
+        x = complex<float>(dist(generator), dist(generator));
+    auto reference = referenceTransform(vector<complex<double>>(a.begin(), a.end()));
+
+    bool passed = true;
+    for (auto isa : {InstructionSet::Scalar, InstructionSet::SSE2, InstructionSet::AVX2}) {
+        FFTPlan plan(n, isa);
+        plan.transform(a.data(), result.data());
+        double error = 0.0;
+        for (int i = 0; i < n; ++i)
+            error = max(error, abs(complex<double>(result[i]) - reference[i]));
+        if (error > 1e-5 * n) {
+            cout << "Mixed-radix FFT with " << instructionSetName(plan.instructionSet()) << " at n = " << n
+                 << " differs from the DFT by " << error << " (FAILED)" << endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+// Checks that the threaded 2D transforms give exactly the serial result
+bool testThreadPool(int n)
+{
+    default_random_engine generator(n);
+    vector<complex<float>> a(n * n);
+    randomHermitian(a, n, generator);
+    FFTPlan plan(n);
+    RealFFTPlan realPlan(n);
+    int h = realPlan.halfSize();
+
+    auto reference = a;
+    plan.transform2D(reference.data());
+    vector<complex<float>> realReference(n * h);
+    for (int i = 0; i < n; ++i)
+        copy(a.begin() + i * n, a.begin() + i * n + h, realReference.begin() + i * h);
+    auto half = realReference;
+    realPlan.transform2D(realReference.data());
+
+    bool passed = true;
+    for (int threads : {2, 3, 8}) {
+        ThreadPool pool(threads);
+        auto result = a;
+        plan.transform2D(result.data(), &pool);
+        auto realResult = half;
+        realPlan.transform2D(realResult.data(), &pool);
+        if (result != reference || realResult != realReference) {
+            cout << "Threaded FFT at n = " << n << " with " << threads
+                 << " threads differs from serial (FAILED)" << endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+// Checks that every FFT mode of the ocean gives the same waves, and that a
+// frame only depends on its time
+bool testOceanModes(int n)
+{
+    VertexBufferOcean ocean(glm::vec2(2.0f, 2.0f), n, 0.02f);
+    float time = 1.5f;
+    ocean.fftMode = FFTMode::Complex;
+    ocean.generateWave(time);
+    vector<float> vertices(ocean.vertices, ocean.vertices + ocean.vertexCount);
+    vector<float> normals(ocean.normals, ocean.normals + ocean.normalCount);
+    float maxValue = 0.0f;
+    for (int i = 0; i < ocean.vertexCount; ++i)
+        maxValue = max(maxValue, max(abs(vertices[i]), abs(normals[i])));
+
+    bool passed = true;
+    for (auto mode : {FFTMode::Complex, FFTMode::Real, FFTMode::Packed}) {
+        ocean.fftMode = mode;
+        ocean.generateWave(time + 1.0f);
+        ocean.generateWave(time);
+        float error = 0.0f;
+        for (int i = 0; i < ocean.vertexCount; ++i) {
+            error = max(error, abs(ocean.vertices[i] - vertices[i]));
+            error = max(error, abs(ocean.normals[i] - normals[i]));
+        }
+        if (error > 1e-5f * maxValue) {
+            cout << "Ocean in FFT mode " << (int)mode << " differs by " << error << " (FAILED)" << endl;
+            passed = false;
+        }
+    }
+
+    // Changing the parameters back and forth gives the same waves again
+    ocean.setParameters(glm::vec2(4.0f, 1.0f), 0.05f);
+    ocean.generateWave(time);
+    bool changed = !equal(vertices.begin(), vertices.end(), ocean.vertices);
+    ocean.setParameters(glm::vec2(2.0f, 2.0f), 0.02f);
+    ocean.fftMode = FFTMode::Complex;
+    ocean.generateWave(time);
+    if (!changed || !equal(vertices.begin(), vertices.end(), ocean.vertices)) {
+        cout << "Ocean parameters are not applied consistently (FAILED)" << endl;
+        passed = false;
+    }
+    if (passed)
+        cout << "Ocean FFT modes agree at n = " << n << " (passed)" << endl;
+    return passed;
+}
+
+// Checks that phases advanced by fixed time steps stay close to the ones
+// evaluated directly, up to the step before they are resynchronized
+bool testTimeSteps()
+{
+    VertexBufferOcean ocean(glm::vec2(2.0f, 2.0f), 128, 0.02f);
+    const float step = 1.0f / 60.0f;
+    const int frames = 64;
+    ocean.setTimeStep(step);
+    for (int frame = 0; frame <= frames; ++frame)
+        ocean.generateWave(frame * step);
+    vector<float> vertices(ocean.vertices, ocean.vertices + ocean.vertexCount);
+
+    ocean.setTimeStep(0.0f);
+    ocean.generateWave(frames * step);
+    float maxHeight = 0.0f, error = 0.0f;
+    for (int i = 1; i < ocean.vertexCount; i += 3) {
+        maxHeight = max(maxHeight, abs(ocean.vertices[i]));
+        error = max(error, abs(ocean.vertices[i] - vertices[i]));
+    }
+    bool passed = error <= 1e-5f * maxHeight;
+    cout << "Ocean heights after " << frames << " time steps differ by " << error << " of "
+         << maxHeight << (passed ? " (passed)" : " (FAILED)") << endl;
+    return passed;
+}
+
+// Checks that an ocean with a loop period repeats after it, and that the
+// frame cache plays back the frames the simulator packs
+bool testLoopingOcean()
+{
+    const int n = 64, frames = 16;
+    const float period = 8.0f;
+    OceanSimulator simulator(glm::vec2(2.0f, 2.0f), n, 0.02f, 0.5f);
+    simulator.setLoopPeriod(period);
+    vector<float> heights(3 * n * n), normals(3 * n * n);
+    vector<float> repeated(3 * n * n), repeatedNormals(3 * n * n);
+    simulator.simulate(1.25f, FFTMode::Real);
+    simulator.packTextures(heights.data(), normals.data());
+    simulator.simulate(1.25f + 3 * period, FFTMode::Real);
+    simulator.packTextures(repeated.data(), repeatedNormals.data());
+    float loopError = 0.0f;
+    for (int i = 0; i < 3 * n * n; ++i)
+        loopError = max(loopError, max(abs(heights[i] - repeated[i]), abs(normals[i] - repeatedNormals[i])));
+
+    // Frame 5 of the cache, sampled one period later
+    OceanFrameCache cache(simulator, frames);
+    simulator.simulate(5 * period / frames, FFTMode::Real);
+    simulator.packTextures(heights.data(), normals.data());
+    cache.sample(period + 5 * period / frames, repeated.data(), repeatedNormals.data());
+    float cacheError = 0.0f;
+    for (int i = 0; i < 3 * n * n; ++i)
+        cacheError = max(cacheError, max(abs(heights[i] - repeated[i]), abs(normals[i] - repeatedNormals[i])));
+
+    // Neither an empty cache nor one without a period can be sampled
+    int rejected = 0;
+    for (int k = 0; k < 2; ++k) {
+        OceanSimulator other(glm::vec2(2.0f, 2.0f), 16, 0.02f, 0.5f);
+        other.setLoopPeriod(k == 0 ? period : 0.0f);
+        try {
+            OceanFrameCache invalid(other, k == 0 ? 0 : frames);
+        } catch (const invalid_argument &) {
+            ++rejected;
+        }
+    }
+
+    bool passed = loopError <= 1e-4f && cacheError <= 1e-4f && rejected == 2;
+    cout << "Looping ocean differs by " << loopError << " after 3 periods and by " << cacheError
+         << " from its frame cache" << (rejected == 2 ? "" : ", invalid caches accepted")
+         << (passed ? " (passed)" : " (FAILED)") << endl;
+    return passed;
+}
+
+// Checks that every map encoding decodes back to the maps within its
+// precision, and that the SIMD encoders write the same texels as the scalar
+bool testMapEncodings()
+{
+    // Not a multiple of the pack chunk or of 8, so every tail is run
+    const int n = 60;
+    OceanSimulator simulator(glm::vec2(2.0f, 2.0f), n, 0.02f, 0.5f);
+    simulator.simulate(2.5f, FFTMode::Real);
+    vector<float> heights(3 * n * n), normals(3 * n * n);
+    simulator.packTextures(heights.data(), normals.data());
+    // Big enough for the texels of any encoding
+    vector<float> heightMap(3 * n * n), normalMap(3 * n * n);
+
+    auto tolerance = [](const MapFormat &format) {
+        switch (format.encoding) {
+            case MapEncoding::RGB32F:    return 1e-4f;
+            case MapEncoding::RGBA16F:   return 2e-3f;
+            case MapEncoding::RG16Snorm: return 1e-3f;
+            case MapEncoding::RGB10A2:   return format.decodeScale() / 1023.0f;
+        }
+        return 0.0f;
+    };
+    bool passed = true;
+    for (auto heightEncoding : {MapEncoding::RGB32F, MapEncoding::RGBA16F, MapEncoding::RGB10A2}) {
+        for (auto normalEncoding : {MapEncoding::RGB32F, MapEncoding::RGBA16F, MapEncoding::RG16Snorm,
+                                    MapEncoding::RGB10A2}) {
+            MapFormat heightFormat = heightMapFormat(heightEncoding), normalFormat = normalMapFormat(normalEncoding);
+            simulator.packTextures(heightFormat, heightMap.data(), normalFormat, normalMap.data());
+            float heightError = 0.0f, normalError = 0.0f;
+            for (int i = 0; i < n * n; ++i) {
+                float x, y, z;
+                decodeTexel(heightEncoding, heightMap.data(), i, x, y, z);
+                glm::vec3 height = glm::vec3(x, y, z) * heightFormat.decodeScale() + heightFormat.decodeBias();
+                glm::vec3 expected = (glm::vec3(heights[3 * i], heights[3 * i + 1], heights[3 * i + 2]) - 0.5f) * 5.0f;
+                heightError = max(heightError, glm::length(height - expected) / sqrt(3.0f));
+
+                decodeTexel(normalEncoding, normalMap.data(), i, x, y, z);
+                glm::vec3 normal = glm::vec3(x, y, z) * normalFormat.decodeScale() + normalFormat.decodeBias();
+                if (normalEncoding == MapEncoding::RG16Snorm)
+                    normal.y = sqrt(max(0.0f, 1.0f - normal.x * normal.x - normal.z * normal.z));
+                expected = (glm::vec3(normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]) - 0.5f) * 2.0f;
+                normalError = max(normalError, glm::length(normal - expected) / sqrt(3.0f));
+            }
+            bool ok = heightError <= tolerance(heightFormat) && normalError <= tolerance(normalFormat);
+            cout << "Maps as " << mapEncodingName(heightEncoding) << " / " << mapEncodingName(normalEncoding)
+                 << " differ by " << heightError << " / " << normalError << (ok ? " (passed)" : " (FAILED)") << endl;
+            passed = passed && ok;
+        }
+    }
+
+    // Both encoders on the same values, including ones out of range
+    default_random_engine generator(5);
+    uniform_real_distribution<float> uniform(-1.5f, 1.5f);
+    const int count = 61;
+    vector<float> x(count), y(count), z(count);
+    for (int i = 0; i < count; ++i) {
+        x[i] = uniform(generator);
+        y[i] = uniform(generator);
+        z[i] = uniform(generator);
+    }
+    for (auto encoding : {MapEncoding::RGB32F, MapEncoding::RGBA16F, MapEncoding::RG16Snorm, MapEncoding::RGB10A2}) {
+        vector<uint8_t> scalar(count * mapTexelSize(encoding)), simd(scalar.size());
+        encodeTexels(encoding, x.data(), y.data(), z.data(), count, scalar.data(), InstructionSet::Scalar);
+        encodeTexels(encoding, x.data(), y.data(), z.data(), count, simd.data(), InstructionSet::Auto);
+        bool same = scalar == simd;
+        cout << "Encoding " << mapEncodingName(encoding) << " with "
+             << instructionSetName(resolveInstructionSet(InstructionSet::Auto))
+             << (same ? " matches scalar (passed)" : " differs from scalar (FAILED)") << endl;
+        passed = passed && same;
+    }
+    return passed;
+}
+
+// Checks the height map statistics of packTextures against the packed map,
+// and the SIMD measurement against the scalar one
+bool testMapStats()
+{
+    const int n = 60;
+    OceanSimulator simulator(glm::vec2(4.0f, 3.0f), n, 0.2f, 0.5f);
+    simulator.simulate(3.0f, FFTMode::Real);
+    vector<float> heights(3 * n * n), normals(3 * n * n);
+    // A narrow range, so that some texels fall outside of it
+    MapFormat format = heightMapFormat(MapEncoding::RGB32F, 1.2f);
+    OceanMapStats stats = simulator.packTextures(format, heights.data(), normalMapFormat(MapEncoding::RGB32F),
+                                                 normals.data());
+    glm::vec3 minimum(numeric_limits<float>::infinity()), maximum(-numeric_limits<float>::infinity());
+    int clipped = 0;
+    for (int i = 0; i < n * n; ++i) {
+        glm::vec3 texel(heights[3 * i], heights[3 * i + 1], heights[3 * i + 2]);
+        minimum = glm::min(minimum, texel * format.decodeScale() + format.decodeBias());
+        maximum = glm::max(maximum, texel * format.decodeScale() + format.decodeBias());
+        clipped += glm::any(glm::lessThan(texel, glm::vec3(0.0f))) || glm::any(glm::greaterThan(texel, glm::vec3(1.0f)));
+    }
+    float error = max(glm::length(stats.minimum - minimum), glm::length(stats.maximum - maximum));
+    bool passed = error <= 1e-5f && stats.clipped == clipped;
+
+    TexelRange scalar, simd;
+    measureTexels(heights.data(), heights.data() + 1, heights.data() + 2, 3 * n * n - 2, scalar, InstructionSet::Scalar);
+    measureTexels(heights.data(), heights.data() + 1, heights.data() + 2, 3 * n * n - 2, simd, InstructionSet::Auto);
+    for (int c = 0; c < 3; ++c)
+        passed = passed && scalar.minimum[c] == simd.minimum[c] && scalar.maximum[c] == simd.maximum[c];
+    passed = passed && scalar.outside == simd.outside;
+    cout << "Map stats: heights " << stats.minimum.y << " to " << stats.maximum.y << ", " << stats.clipped
+         << " of " << n * n << " texels clipped" << (passed ? " (passed)" : " (FAILED)") << endl;
+    return passed;
+}
+
+// Checks that the triple buffer only ever hands over whole values, newest
+// first, and that the producer packs what the simulator packs itself
+bool testOceanProducer()
+{
+    const int values = 1000000, width = 16;
+    TripleBuffer buffer;
+    int slots[3][width] = {};
+    bool consistent = true;
+    thread writer([&] {
+        for (int value = 1; value <= values; ++value) {
+            int *slot = slots[buffer.writeSlot()];
+            for (int k = 0; k < width; ++k)
+                slot[k] = value;
+            buffer.publish();
+        }
+    });
+    int last = 0;
+    while (last < values) {
+        if (!buffer.acquire())
+            continue;
+        const int *slot = slots[buffer.readSlot()];
+        for (int k = 0; k < width; ++k)
+            consistent = consistent && slot[k] == slot[0];
+        consistent = consistent && slot[0] > last;
+        last = slot[0];
+    }
+    writer.join();
+
+    const int n = 64;
+    OceanSimulator simulator(glm::vec2(2.0f, 2.0f), n, 0.02f, 0.5f), reference(glm::vec2(2.0f, 2.0f), n, 0.02f, 0.5f);
+    simulator.setSeed(3);
+    reference.setSeed(3);
+    MapFormat heightFormat = heightMapFormat(MapEncoding::RGBA16F), normalFormat = normalMapFormat(MapEncoding::RG16Snorm);
+    vector<float> heights(3 * n * n), normals(3 * n * n);
+    reference.simulate(4.0f, FFTMode::Real);
+    reference.packTextures(heightFormat, heights.data(), normalFormat, normals.data());
+    bool same;
+    {
+        OceanProducer producer(simulator);
+        producer.request(4.0f, FFTMode::Real, heightFormat, normalFormat);
+        producer.waitForRequest();
+        const OceanFrame *frame = producer.latest();
+        same = frame && frame->time == 4.0f && !producer.latest()
+               && memcmp(frame->heightMap, heights.data(), n * n * mapTexelSize(heightFormat.encoding)) == 0
+               && memcmp(frame->normalMap, normals.data(), n * n * mapTexelSize(normalFormat.encoding)) == 0;
+    }
+    bool passed = consistent && same;
+    cout << "Triple buffer " << (consistent ? "consistent" : "torn") << " over " << values << " values, producer frame "
+         << (same ? "matches" : "differs") << (passed ? " (passed)" : " (FAILED)") << endl;
+    return passed;
+}
+
+// Checks that baked animations play back the maps they were written from,
+// in every encoding, read ahead or not
+bool testBakedOcean()
+{
+    const int n = 32, frames = 6;
+    const char *path = "FFTTest.bak";
+    OceanSimulator simulator(glm::vec2(2.0f, 2.0f), n, 0.02f, 0.5f);
+    vector<vector<float>> heights(frames, vector<float>(3 * n * n)), normals = heights;
+    for (int frame = 0; frame < frames; ++frame) {
+        simulator.simulate(frame * 0.1f, FFTMode::Real);
+        simulator.packTextures(heights[frame].data(), normals[frame].data());
+    }
+
+    bool passed = true;
+    for (auto encoding : {BakedEncoding::Half, BakedEncoding::Int16}) {
+        for (auto compression : {BakedCompression::None, BakedCompression::LZ4}) {
+            {
+                BakedOceanWriter writer(path, bakedOceanHeader(n, 4.0f, glm::vec2(2.0f, 2.0f), 0.02f, 10.0f,
+                                                               encoding, compression));
+                for (int frame = 0; frame < frames; ++frame)
+                    writer.write(heights[frame].data(), normals[frame].data());
+                writer.finish();
+            }
+            // The maps are within [0, 1] but for the largest heights, which
+            // int16 clamps to it
+            float tolerance = encoding == BakedEncoding::Half ? 1.0f / 2048 : 1.0f / 32767;
+            float error = 0.0f;
+            BakedOceanPlayer player(path, 2);
+            for (int frame : {0, 1, 2, 3, 4, 5, 0, 1, 4, 2, 2, frames - 1}) {
+                const float *height, *normal;
+                player.acquire(frame, height, normal);
+                for (int i = 0; i < 3 * n * n; ++i) {
+                    float expected = heights[frame][i];
+                    if (encoding == BakedEncoding::Int16)
+                        expected = min(1.0f, max(0.0f, expected));
+                    error = max(error, abs(height[i] - expected));
+                    error = max(error, abs(normal[i] - normals[frame][i]));
+                }
+            }
+            if (error > tolerance || player.frameAt(0.25f) != 2 || player.frameAt(0.65f) != 0) {
+                cout << "Baked ocean with encoding " << (int)encoding << " and compression " << (int)compression
+                     << " differs by " << error << " (FAILED)" << endl;
+                passed = false;
+            }
+        }
+    }
+
+    // Anything but a baked file is rejected
+    {
+        ofstream file(path, ios::binary);
+        file << "not an ocean";
+    }
+    try {
+        BakedOceanFile file(path);
+        cout << "Invalid baked file was accepted (FAILED)" << endl;
+        passed = false;
+    } catch (const runtime_error &) {
+    }
+    remove(path);
+    if (passed)
+        cout << "Baked ocean plays back its frames (passed)" << endl;
+    return passed;
+}
+
+// Checks that queries at the displaced grid points find the grid values,
+// that the SIMD kernels agree with the scalar ones, and that queries stay
+// whole while frames are published
+bool testOceanQuery()
 {
-    vector<complex<double>> a = {0.1, 0.2, 0.3, 0.4, 0.0, 0.0, 0.0, 0.0};
+    const int n = 64;
+    const float step = 0.05f;
+    // Waves that are steep but do not fold over
+    OceanSimulator simulator(glm::vec2(4.0f, 3.0f), n, 0.01f, 0.5f);
+    simulator.setSeed(5);
+    OceanQuery query, scalarQuery(InstructionSet::Scalar);
+    vector<float> heights[2], dispX[2], dispZ[2];
+    for (int frame = 0; frame < 2; ++frame) {
+        simulator.simulate(2.0f + frame * step, FFTMode::Real);
+        query.publish(simulator, 2.0f + frame * step);
+        scalarQuery.publish(simulator, 2.0f + frame * step);
+        OceanFields f = simulator.fields();
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                int index = i * f.rowStride + j * f.step;
+                heights[frame].push_back(f.height[index]);
+                dispX[frame].push_back(f.dispX[index]);
+                dispZ[frame].push_back(f.dispZ[index]);
+            }
+        }
+    }
 
-    auto y = recursiveFFT(a);
-    cout << "Result of recursive FFT: " << endl;
-    for (auto i : y) cout << i;
-    cout << endl;
-    auto ry = reverseRecursiveFFT(y);
-    cout << "Then reverse FFT to original results: " << endl;
-    for (auto i : ry) cout << i;
-    cout << endl;
+    // Every grid point, where it is displaced to
+    float spacing = (float)simulator.length() / n;
+    vector<float> x(n * n), z(n * n);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            x[i * n + j] = i * spacing - dispX[1][i * n + j];
+            z[i * n + j] = j * spacing - dispZ[1][i * n + j];
+        }
+    }
+    vector<float> height(n * n), velocityY(n * n), scalarHeight(n * n);
+    OceanSurfaceSamples samples;
+    samples.height = height.data();
+    samples.velocityY = velocityY.data();
+    query.sample(x.data(), z.data(), n * n, 2.0f + step, samples);
+    float waves = 0.0f, heightError = 0.0f, velocityError = 0.0f;
+    for (int i = 0; i < n * n; ++i) {
+        waves = max(waves, fabs(heights[1][i]));
+        heightError = max(heightError, fabs(height[i] - heights[1][i]));
+        velocityError = max(velocityError, fabs(velocityY[i] - (heights[1][i] - heights[0][i]) / step));
+    }
+
+    // Points anywhere, also far outside of the patch
+    mt19937 random(7);
+    uniform_real_distribution<float> position(-100.0f, 100.0f);
+    for (int i = 0; i < n * n; ++i)
+        x[i] = position(random), z[i] = position(random);
+    query.sample(x.data(), z.data(), n * n - 3, 2.02f, samples);
+    samples.height = scalarHeight.data();
+    scalarQuery.sample(x.data(), z.data(), n * n - 3, 2.02f, samples);
+    float isaError = 0.0f;
+    for (int i = 0; i < n * n - 3; ++i)
+        isaError = max(isaError, fabs(height[i] - scalarHeight[i]));
+
+    // Frames alternate between the waves of two times while another thread
+    // queries past them, so every query must find exactly one of the two
+    const int frames = 200, points = 256;
+    vector<float> expected[2];
+    for (int k = 0; k < 2; ++k) {
+        OceanQuery single;
+        simulator.simulate(10.0f + k, FFTMode::Real);
+        single.publish(simulator, 0.0f);
+        expected[k].resize(points);
+        samples.height = expected[k].data();
+        single.sample(x.data(), z.data(), points, 0.0f, samples);
+    }
+    atomic<bool> done(false);
+    thread publisher([&] {
+        for (int frame = 0; frame < frames; ++frame) {
+            simulator.simulate(10.0f + frame % 2, FFTMode::Real);
+            query.publish(simulator, 10.0f + frame);
+        }
+        done = true;
+    });
+    bool whole = true;
+    while (!done) {
+        query.sample(x.data(), z.data(), points, 1000.0f, samples);
+        bool first = true, second = true;
+        for (int i = 0; i < points; ++i) {
+            first = first && samples.height[i] == expected[0][i];
+            second = second && samples.height[i] == expected[1][i];
+        }
+        whole = whole && (first || second);
+    }
+    publisher.join();
 
-    y = iterativeFFT(a);
-    cout << "Result of iterative FFT: " << endl;
-    for (auto i : y) cout << i;
-    cout << endl;
+    bool passed = heightError <= 0.02f * waves && velocityError <= 0.02f * waves / step
+                  && isaError <= 1e-4f * waves && whole;
+    cout << "Ocean query: heights off by " << heightError << " of " << waves << ", vertical velocity by "
+         << velocityError << ", SIMD by " << isaError << (whole ? "" : ", torn frames")
+         << (passed ? " (passed)" : " (FAILED)") << endl;
+    return passed;
+}
 
+// Checks that generateWave does not allocate once the ocean is constructed
+bool testAllocations()
+{
+    VertexBufferOcean ocean(glm::vec2(2.0f, 2.0f), 128, 0.02f);
+    const pair<FFTMode, const char *> modes[] = {
+            {FFTMode::Complex, "complex"}, {FFTMode::Real, "real"}, {FFTMode::Packed, "packed"}};
+    bool passed = true;
+    for (int threads : {1, 4}) {
+        ocean.setThreadCount(threads);
+        for (auto &mode : modes) {
+            ocean.fftMode = mode.first;
+            long before = allocationCount;
+            for (int frame = 0; frame < 3; ++frame)
+                ocean.generateWave(frame * 0.1f);
+            long allocations = allocationCount - before;
+            if (allocations != 0) {
+                cout << "generateWave in " << mode.second << " mode with " << threads << " threads made "
+                     << allocations << " allocations in 3 frames (FAILED)" << endl;
+                passed = false;
+            }
+        }
+    }
+    if (passed)
+        cout << "generateWave makes no allocations (passed)" << endl;
+    return passed;
+}
+
+// Checks the phases of the spectrum kernels against std::cos and std::sin,
+// and the spectra they write against the formulas evaluated in double
+bool testSpectrumKernels()
+{
+    const int count = 1001;
+    default_random_engine generator(count);
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    vector<vector<float>> table(13, vector<float>(count));
+    for (int j = 0; j < 9; ++j)
+        for (auto &x : table[j])
+            x = dist(generator);
+    // omega of the ocean ranges up to about 20
+    for (auto &x : table[4])
+        x = 10.0f * (x + 1.0f);
+    SpectrumTables tables = {table[0].data(), table[1].data(), table[2].data(), table[3].data(),
+                             table[4].data(), table[5].data(), table[6].data(), table[7].data(),
+                             table[8].data(), table[9].data(), table[10].data(), table[11].data(),
+                             table[12].data()};
+
+    bool passed = true;
+    for (auto isa : {InstructionSet::Scalar, InstructionSet::AVX2}) {
+        for (double time : {0.0, 1.25, 5000.37, -123456.7}) {
+            vector<complex<float>> fields(5 * count);
+            SpectrumFields out = {&fields[0], &fields[count], &fields[2 * count], &fields[3 * count],
+                                  &fields[4 * count]};
+            evaluateSpectrum(tables, 0, count, time, out, isa);
+            double phaseError = 0.0, fieldError = 0.0;
+            for (int i = 0; i < count; ++i) {
+                double c = cos((double)table[4][i] * time), s = sin((double)table[4][i] * time);
+                phaseError = max(phaseError, max(abs(table[11][i] - c), abs(table[12][i] - s)));
+                complex<double> h = complex<double>(table[0][i], table[1][i]) * complex<double>(c, s)
+                                    + complex<double>(table[2][i], table[3][i]) * complex<double>(c, -s);
+                complex<double> I(0.0, 1.0);
+                complex<double> expected[5] = {h, I * (double)table[5][i] * h, I * (double)table[6][i] * h,
+                                               -I * (double)table[7][i] * h, -I * (double)table[8][i] * h};
+                for (int f = 0; f < 5; ++f)
+                    fieldError = max(fieldError, abs(complex<double>(fields[f * count + i]) - expected[f]));
+            }
+            // The inputs are below 1, so the spectra are off by a few times
+            // the phase error
+            if (phaseError > SpectrumPhaseError || fieldError > 10 * SpectrumPhaseError) {
+                cout << "Spectrum kernel with " << instructionSetName(resolveInstructionSet(isa))
+                     << " at time " << time << ": phase error " << phaseError << ", spectrum error "
+                     << fieldError << " (FAILED)" << endl;
+                passed = false;
+            }
+        }
+    }
+    if (passed)
+        cout << "Spectrum kernels are within " << SpectrumPhaseError << " of std::sin and std::cos (passed)"
+             << endl;
+    return passed;
+}
+
+// 2D transform with strided column passes, as generateWave used to do it
+void stridedTransform2D(const FFTPlan &plan, complex<float> *data)
+{
+    int n = plan.size();
+    vector<complex<float>> a(n);
+    for (int i = 0; i < n; ++i)
+        plan.transform(data + i * n);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j)
+            a[j] = data[j * n + i];
+        plan.transform(a.data());
+        for (int j = 0; j < n; ++j)
+            data[j * n + i] = a[j];
+    }
+}
+
+// Fastest time of a call of f in milliseconds, out of as many calls as fit
+// in half a second. The minimum is much less noisy than the mean on a
+// loaded machine.
+template <typename F>
+double millisecondsPerCall(F f)
+{
+    using clock = chrono::steady_clock;
+    f();
+    double best = 1e30, elapsed = 0.0;
+    int calls = 0;
+    while (elapsed < 500.0 || calls < 3) {
+        auto start = clock::now();
+        f();
+        double ms = chrono::duration<double, milli>(clock::now() - start).count();
+        best = min(best, ms);
+        elapsed += ms;
+        ++calls;
+    }
+    return best;
+}
+
+// One row of the benchmark report
+struct BenchmarkResult
+{
+    string engine;
+    int dimensions;
+    int n;
+    int threads;
+    double nsPerPoint;
+    double gflops;
+    // Largest deviation from the double precision reference, relative to
+    // the largest value of the reference
+    double error;
+};
+
+struct BenchmarkOptions
+{
+    bool json = false;
+    // Empty for stdout
+    string output;
+    // Largest thread count of the 2D benchmarks
+    int maxThreads = max(1, (int)thread::hardware_concurrency());
+};
+
+// Flops of a complex transform over points values in total, counted as
+// 5 N log2(N) like most FFT benchmarks do, whatever the algorithm
+double transformFlops(double points)
+{
+    return 5.0 * points * log2(points);
+}
+
+double relativeError(const complex<float> *result, const vector<complex<double>> &reference)
+{
+    double error = 0.0, scale = 0.0;
+    for (size_t i = 0; i < reference.size(); ++i) {
+        error = max(error, abs(complex<double>(result[i]) - reference[i]));
+        scale = max(scale, abs(reference[i]));
+    }
+    return scale > 0.0 ? error / scale : error;
+}
+
+double relativeError(const vector<complex<double>> &result, const vector<complex<double>> &reference)
+{
+    vector<complex<float>> rounded(result.begin(), result.end());
+    return relativeError(rounded.data(), reference);
+}
+
+// Transforms every row and then every column of an n*n array with f
+template <typename F>
+void rowColumn(vector<complex<double>> &data, int n, F f)
+{
+    vector<complex<double>> line(n);
+    for (int i = 0; i < n; ++i) {
+        copy(data.begin() + i * n, data.begin() + (i + 1) * n, line.begin());
+        line = f(line);
+        copy(line.begin(), line.end(), data.begin() + i * n);
+    }
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i)
+            line[i] = data[i * n + j];
+        line = f(line);
+        for (int i = 0; i < n; ++i)
+            data[i * n + j] = line[i];
+    }
+}
+
+void benchmark1D(int n, vector<BenchmarkResult> &results)
+{
+    default_random_engine generator(n);
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    vector<complex<float>> a(n), A(n);
+    for (auto &x : a)
+        x = complex<float>(dist(generator), dist(generator));
+    vector<complex<double>> ad(a.begin(), a.end()), result;
+    auto reference = referenceTransform(ad);
+    bool powerOfTwo = (n & (n - 1)) == 0;
+
+    // Enough transforms per call for the clock to resolve them
+    int repeat = max(1, 65536 / n);
+    auto add = [&](const string &engine, double ms, double error) {
+        double ns = ms * 1e6 / repeat;
+        results.push_back({engine, 1, n, 1, ns / n, transformFlops(n) / ns, error});
+    };
+
+    if (powerOfTwo) {
+        double ms = millisecondsPerCall([&] {
+            for (int r = 0; r < repeat; ++r)
+                result = recursiveFFT(ad);
+        });
+        add("recursiveFFT", ms, relativeError(result, reference));
+        ms = millisecondsPerCall([&] {
+            for (int r = 0; r < repeat; ++r)
+                result = iterativeFFT(ad);
+        });
+        add("iterativeFFT", ms, relativeError(result, reference));
+    }
+
+    auto plan = [&](const string &engine, const FFTPlan &p) {
+        double ms = millisecondsPerCall([&] {
+            for (int r = 0; r < repeat; ++r)
+                p.transform(a.data(), A.data());
+        });
+        add(engine, ms, relativeError(A.data(), reference));
+    };
+    if (powerOfTwo)
+        plan("cooley-tukey", FFTPlan(n, InstructionSet::Auto, FFTAlgorithm::CooleyTukey));
+    plan("stockham", FFTPlan(n, InstructionSet::Auto, FFTAlgorithm::Stockham));
+    FFTPlan fixed(n);
+    if (fixed.specialized())
+        plan("fixed", fixed);
+}
+
+void benchmark2D(int n, const BenchmarkOptions &options, vector<BenchmarkResult> &results)
+{
+    default_random_engine generator(n);
+    vector<complex<float>> a(n * n);
+    randomHermitian(a, n, generator);
+    vector<complex<double>> reference(a.begin(), a.end());
+    rowColumn(reference, n, referenceTransform);
+    double points = (double)n * n;
+
+    auto add = [&](const string &engine, int threads, double ms, double flops, double error) {
+        double ns = ms * 1e6;
+        results.push_back({engine, 2, n, threads, ns / points, flops / ns, error});
+    };
+
+    // The reference implementations are far too slow beyond this
+    if (n <= 512) {
+        vector<complex<double>> ad(a.begin(), a.end()), data;
+        double ms = millisecondsPerCall([&] {
+            data = ad;
+            rowColumn(data, n, iterativeFFT);
+        });
+        add("iterativeFFT", 1, ms, transformFlops(points), relativeError(data, reference));
+    }
+
+    // Timed calls transform the same buffer over and over, so the error
+    // is taken from a separate first call
+    FFTPlan generic(n, InstructionSet::Auto, FFTAlgorithm::CooleyTukey);
+    auto data = a;
+    stridedTransform2D(generic, data.data());
+    double error = relativeError(data.data(), reference);
+    double ms = millisecondsPerCall([&] { stridedTransform2D(generic, data.data()); });
+    add("strided", 1, ms, transformFlops(points), error);
+
+    FFTPlan plan(n);
+    RealFFTPlan realPlan(n);
+    int h = realPlan.halfSize();
+    vector<complex<float>> half(n * h);
+    for (int i = 0; i < n; ++i)
+        copy(a.begin() + i * n, a.begin() + i * n + h, half.begin() + i * h);
+    vector<int> threadCounts;
+    for (int threads = 1; threads < options.maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(options.maxThreads);
+    for (int threads : threadCounts) {
+        ThreadPool pool(threads);
+        data = a;
+        plan.transform2D(data.data(), &pool);
+        error = relativeError(data.data(), reference);
+        ms = millisecondsPerCall([&] { plan.transform2D(data.data(), &pool); });
+        add(plan.specialized() ? "tiled-fixed" : "tiled", threads, ms, transformFlops(points), error);
+
+        // The real transform only computes the real part, and does half of
+        // the work of the complex one
+        auto realData = half;
+        realPlan.transform2D(realData.data(), &pool);
+        auto *real = reinterpret_cast<const float *>(realData.data());
+        double realError = 0.0, scale = 0.0;
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                realError = max(realError, abs(real[i * 2 * h + j] - reference[i * n + j].real()));
+                scale = max(scale, abs(reference[i * n + j].real()));
+            }
+        }
+        ms = millisecondsPerCall([&] { realPlan.transform2D(realData.data(), &pool); });
+        add("real", threads, ms, 0.5 * transformFlops(points), realError / scale);
+    }
+}
+
+void writeCSV(ostream &out, const vector<BenchmarkResult> &results)
+{
+    out << "engine,dimensions,n,threads,isa,ns_per_point,gflops,error" << endl;
+    for (const auto &r : results)
+        out << r.engine << "," << r.dimensions << "," << r.n << "," << r.threads << ","
+            << instructionSetName(resolveInstructionSet(InstructionSet::Auto)) << ","
+            << r.nsPerPoint << "," << r.gflops << "," << r.error << endl;
+}
+
+void writeJSON(ostream &out, const vector<BenchmarkResult> &results)
+{
+    out << "{" << endl
+        << "  \"isa\": \"" << instructionSetName(resolveInstructionSet(InstructionSet::Auto)) << "\"," << endl
+        << "  \"hardware_threads\": " << thread::hardware_concurrency() << "," << endl
+        << "  \"results\": [" << endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto &r = results[i];
+        out << "    {\"engine\": \"" << r.engine << "\", \"dimensions\": " << r.dimensions
+            << ", \"n\": " << r.n << ", \"threads\": " << r.threads
+            << ", \"ns_per_point\": " << r.nsPerPoint << ", \"gflops\": " << r.gflops
+            << ", \"error\": " << r.error << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl << "}" << endl;
+}
+
+// Times every engine in one and two dimensions and writes one result per
+// engine, size and thread count
+int benchmark(const BenchmarkOptions &options)
+{
+    vector<BenchmarkResult> results;
+    for (int n : {64, 128, 192, 256, 384, 512, 768, 1024, 2048, 4096})
+        benchmark1D(n, results);
+    for (int n = 128; n <= 2048; n *= 2)
+        benchmark2D(n, options, results);
+
+    ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output);
+        if (!file) {
+            cerr << "Cannot write " << options.output << endl;
+            return 1;
+        }
+    }
+    ostream &out = options.output.empty() ? cout : file;
+    if (options.json)
+        writeJSON(out, results);
+    else
+        writeCSV(out, results);
     return 0;
-}
\ No newline at end of file
+}
+
+// Checks the reference implementations above against the double precision
+// reference transform, and the inverse against the original input
+bool testReferenceFFTs()
+{
+    bool passed = true;
+    for (int n = 1; n <= 1024; n *= 2) {
+        default_random_engine generator(n);
+        uniform_real_distribution<double> dist(-1.0, 1.0);
+        vector<complex<double>> a(n);
+        for (auto &x : a)
+            x = complex<double>(dist(generator), dist(generator));
+        auto reference = referenceTransform(a);
+        // Their PI only has float precision
+        double recursiveError = relativeError(recursiveFFT(a), reference);
+        double iterativeError = relativeError(iterativeFFT(a), reference);
+        double inverseError = relativeError(reverseRecursiveFFT(recursiveFFT(a)), a);
+        if (max(recursiveError, max(iterativeError, inverseError)) > 1e-5) {
+            cout << "Reference FFTs at n = " << n << ": recursive error " << recursiveError
+                 << ", iterative error " << iterativeError << ", inverse error " << inverseError
+                 << " (FAILED)" << endl;
+            passed = false;
+        }
+    }
+    if (passed)
+        cout << "Reference FFTs agree with the DFT (passed)" << endl;
+    return passed;
+}
+
+// Without arguments, runs the tests and returns 1 if any fails.
+// "bench [--json] [--output file] [--threads n]" runs the benchmarks and
+// writes CSV, or JSON with --json, to stdout or the file.
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        BenchmarkOptions options;
+        for (int i = 2; i < argc; ++i) {
+            if (strcmp(argv[i], "--json") == 0) {
+                options.json = true;
+            } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+                options.output = argv[++i];
+            } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                options.maxThreads = max(1, atoi(argv[++i]));
+            } else {
+                cerr << "Usage: " << argv[0] << " bench [--json] [--output file] [--threads n]" << endl;
+                return 1;
+            }
+        }
+        return benchmark(options);
+    }
+
+    bool passed = testReferenceFFTs();
+    for (int n = 2; n <= 512; n *= 2)
+        passed = testFFTModes(n) && passed;
+    for (int n : {6, 10, 12, 96, 192})
+        passed = testFFTModes(n) && passed;
+    for (int n = 1; n <= 4096; n *= 2)
+        passed = testInstructionSets(n) && passed;
+    for (int n : {3, 5, 6, 9, 15, 24, 25, 40, 60, 96, 120, 192, 320, 384, 640, 768, 1000})
+        passed = testMixedRadix(n) && passed;
+    for (int n = 2; n <= 1024; n *= 2)
+        passed = testThreadPool(n) && passed;
+    passed = testSpectrumKernels() && passed;
+    passed = testOceanModes(128) && passed;
+    passed = testOceanModes(96) && passed;
+    passed = testTimeSteps() && passed;
+    passed = testLoopingOcean() && passed;
+    passed = testBakedOcean() && passed;
+    passed = testMapEncodings() && passed;
+    passed = testMapStats() && passed;
+    passed = testOceanProducer() && passed;
+    passed = testOceanQuery() && passed;
+    passed = testAllocations() && passed;
+
+    return passed ? 0 : 1;
+}
@@ -4,75 +4,50 @@
 
 #include "Ocean.h"
 
-#include <random>
-#include <iostream>
-#include <vector>
-
-static const float PI = 3.1415926f;
-
-static void bitReverseCopy(const std::vector<std::complex<float>> &a,
-                           std::vector<std::complex<float>> &A)
-{
-    static int n = -1;
-    static int *rev = nullptr;
-    // Initialize rev[n] so that there is no need to recompute it later
-    if (n != (int)A.size()) {
-        n = (int)A.size();
-        delete[] rev;
-        rev = new int[n];
-
-        for (int i = 0; i < n; ++i) {
-            // 0b001 -> 0b100
-            int revi = i;
-            int len = 1;
-            for (int j = 0; j < 32; ++j) {
-                if ((1 << j) == n) {
-                    len = j;
-                    break;
-                }
-            }
-            for (int j = 0; j < len / 2; ++j) {
-                int tmp1 = (revi >> j) & 0x1;
-                int tmp2 = (revi >> (len - 1 - j)) & 0x1;
-                revi = revi & ~(1 << j);
-                revi = revi | (tmp2 << j);
-                revi = revi & ~(1 << (len - 1 - j));
-                revi = revi | (tmp1 << (len - 1 - j));
-            }
-            rev[i] = revi;
-        }
-    }
-
-    for (int i = 0; i < n; ++i) {
-        A[rev[i]] = a[i];
-    }
-}
-
-void iterativeFFT(const std::vector<std::complex<float>> &a,
-                  std::vector<std::complex<float>> &A)
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// The spectrum is evaluated at (time + 10000) * TimeScale
+static const float TimeScale = 0.5f;
+// Height range of the maps without auto-range, the one of the original maps
+static const float DefaultHeightRange = 2.5f;
+// Auto-range packs with the extremes of the last frame times the margin, and
+// shrinks by at most the decay per frame so the range settles
+static const float AutoRangeMargin = 1.25f;
+static const float AutoRangeDecay = 0.99f;
+static const float MinimumHeightRange = 0.05f;
+// Frame of no fixed rate frame
+static const long long NoFrame = -1;
+
+// The GL description of the texels of an encoding
+static void textureFormat(MapEncoding encoding, GLint &internalFormat, GLenum &format, GLenum &type)
 {
-    using namespace std;
-    auto n = a.size();
-    bitReverseCopy(a, A);
-    for (int s = 1; (1 << s) <= n; ++s) {
-        auto m = (1 << s);
-        auto wm = complex<float>(cos(2*PI/m), sin(2*PI/m));
-        for (int k = 0; k < n; k += m) {
-            complex<float> w = 1.0;
-            for (int j = 0; j < m/2; ++j) {
-                auto t = w * A[k + j + m/2];
-                auto u = A[k + j];
-                A[k + j] = u + t;
-                A[k + j + m/2] = u - t;
-                w = w * wm;
-            }
-        }
+    internalFormat = GL_RGB32F, format = GL_RGB, type = GL_FLOAT;
+    switch (encoding) {
+        case MapEncoding::RGB32F:
+            break;
+        case MapEncoding::RGBA16F:
+            internalFormat = GL_RGBA16F, format = GL_RGBA, type = GL_HALF_FLOAT;
+            break;
+        case MapEncoding::RG16Snorm:
+            internalFormat = GL_RG16_SNORM, format = GL_RG, type = GL_SHORT;
+            break;
+        case MapEncoding::RGB10A2:
+            internalFormat = GL_RGB10_A2, format = GL_RGBA, type = GL_UNSIGNED_INT_2_10_10_10_REV;
+            break;
     }
 }
 
-
 Ocean::Ocean(glm::vec2 wind, int resolution, float amplitude)
-        : w(wind), N(resolution), A(amplitude)
+        : N(resolution), simulator(wind, resolution, amplitude, TimeScale),
+          surfaceQueries(false), asyncSimulation(false), lastWaveTime(-1.0f),
+          heightFormat(heightMapFormat(MapEncoding::RGB32F)), normalFormat(normalMapFormat(MapEncoding::RGB32F)),
+          heightRange(DefaultHeightRange), autoRange(false), stats(),
+          shown(0), next(0), blend(0.0f), simulationRate(0.0f), timeStep(0.0f), requestedFrame(NoFrame),
+          nextUploadBuffer(0), streaming(false), lastUploadTime(0.0)
 {
     // Precompute indices and vertices
     vertexCount = 3 * N * N;
@@ -97,332 +72,447 @@ Ocean::Ocean(glm::vec2 wind, int resolution, float amplitude)
             vertices[pos + 2] = (j - N / 2) * 8;
         }
     }
-    // Initialize ocean wave related data
-    g  = 9.8f;
-    PI = 3.1415926f;
-    L  =  N / 8;
-    unitWidth = 3.0f;
-    choppy = 0.0f;
-    hBuffer            = new std::complex<float>[N * N];
-    kBuffer            = new glm::vec2[N * N];
-    epsilonBufferx     = new std::complex<float>[N * N];
-    epsilonBuffery     = new std::complex<float>[N * N];
-    displacementBufferx = new std::complex<float>[N * N];
-    displacementBuffery = new std::complex<float>[N * N];
-
-    heightMapBuffer = new float[3 * N * N];
-    normalMapBuffer = new float[3 * N * N];
-
-    // Compute k buffer
-    for (int n = -N / 2; n < N / 2; ++n) {
-        float kx = 2.0f * PI * n / L;
-        for (int m = -N / 2; m < N / 2; ++m) {
-            glm::vec2 k = glm::vec2(kx, 2.0f * PI * m / L);
-            int bufferIndex = (n + N/2) * N + m + N/2;
-            kBuffer[bufferIndex] = k;
+    useFFT = true;
+    fftMode = FFTMode::Real;
+
+    heightMapBuffer = allocateAlignedArray<float>(3 * N * N);
+    normalMapBuffer = allocateAlignedArray<float>(3 * N * N);
+
+    // Setup height map and normal map, two of each for the frames blended
+    // at a fixed simulation rate
+    for (auto &pair : textures) {
+        for (unsigned int *texture : {&pair.height, &pair.normal}) {
+            glGenTextures(1, texture);
+            glBindTexture(GL_TEXTURE_2D, *texture);
+            // Set default texture wrapping/filtering options
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         }
+        pair.size = 0;
+        pair.heightFormat = heightFormat;
+        pair.normalFormat = normalFormat;
+        pair.frame = NoFrame;
     }
+    showTextures();
 
-    // Setup height map and normal map
-    glGenTextures(1, &heightMap);
-    glBindTexture(GL_TEXTURE_2D, heightMap);
-    // Set default texture wrapping/filtering options
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // Setup height map and normal map
-    glGenTextures(1, &normalMap);
-    glBindTexture(GL_TEXTURE_2D, normalMap);
-    // Set default texture wrapping/filtering options
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    for (auto &upload : uploadBuffers) {
+        glGenBuffers(1, &upload.buffer);
+        upload.size = 0;
+        upload.fence = nullptr;
+    }
 }
 
 Ocean::~Ocean()
 {
     delete[] vertices;
     delete[] indices;
-    delete[] hBuffer;
-    delete[] kBuffer;
-    delete[] epsilonBufferx;
-    delete[] epsilonBuffery;
-    delete[] displacementBufferx;
-    delete[] displacementBuffery;
-    delete[] heightMapBuffer;
-    delete[] normalMapBuffer;
+    freeAligned(heightMapBuffer);
+    freeAligned(normalMapBuffer);
+    for (auto &upload : uploadBuffers) {
+        if (upload.fence)
+            glDeleteSync(upload.fence);
+        glDeleteBuffers(1, &upload.buffer);
+    }
 }
 
-void Ocean::generateWave(float time)
+void Ocean::setThreadCount(int threads)
 {
-    // Eliminate inital status when time accumulate from 0
-    time += 10000;
-    time /= 2;
-    using namespace std;
-    // Compute buffers
-    for (int n = -N / 2; n < N / 2; ++n) {
-        for (int m = -N / 2; m < N / 2; ++m) {
-            int bufferIndex = (n + N/2) * N + m + N/2;
-            hBuffer[bufferIndex] = h(kBuffer[bufferIndex], time);
-
-            epsilonBufferx[bufferIndex] = hBuffer[bufferIndex] * complex<float>(0.0f, kBuffer[bufferIndex].x);
-            epsilonBuffery[bufferIndex] = hBuffer[bufferIndex] * complex<float>(0.0f, kBuffer[bufferIndex].y);
-
-            auto currk = kBuffer[bufferIndex];
-            float klength = sqrt(currk.x*currk.x+currk.y*currk.y);
-            if (klength < 0.00001) {
-                displacementBufferx[bufferIndex] = 0;
-                displacementBuffery[bufferIndex] = 0;
-            } else {
-                displacementBufferx[bufferIndex] = -(epsilonBufferx[bufferIndex] / klength);
-                displacementBuffery[bufferIndex] = -(epsilonBuffery[bufferIndex] / klength);
-            }
-        }
-    }
-
-    // Set Wave vertices and normals seperately
-        auto *HBuffer = new std::complex<float>[N * N];
-
-        // First round of FFT on rows
-        for (int i = 0; i < N; ++i) {
-            vector<complex<float>> a(N), buf(N);
+    producer.reset();
+    simulator.setThreadCount(threads);
+    updateProducer();
+}
 
-            for (int j = 0; j < N; ++j)
-                a[j] = hBuffer[i * N + j];
-            iterativeFFT(a, buf);
-            for (int j = 0; j < N; ++j)
-                HBuffer[i * N + j] = buf[j];
+void Ocean::setParameters(glm::vec2 wind, float amplitude)
+{
+    producer.reset();
+    simulator.setParameters(wind, amplitude);
+    query.clear();
+    if (loop)
+        loop.reset(new OceanFrameCache(simulator, loop->frameCount(), fftMode));
+    dropFrames();
+    updateProducer();
+}
 
-            vector<complex<float>> b(N), c(N), buf2(N), buf3(N);
-            for (int j = 0; j < N; ++j) {
-                b[j] = epsilonBufferx[i * N + j];
-                c[j] = epsilonBuffery[i * N + j];
-            }
-            iterativeFFT(b, buf2);
-            iterativeFFT(c, buf3);
-            for (int j = 0; j < N; ++j) {
-                epsilonBufferx[i * N + j] = buf2[j];
-                epsilonBuffery[i * N + j] = buf3[j];
-            }
+void Ocean::setTimeStep(float step)
+{
+    timeStep = step;
+    if (simulationRate == 0.0f) {
+        producer.reset();
+        simulator.setTimeStep(step);
+        updateProducer();
+    }
+}
 
-            for (int j = 0; j < N; ++j) {
-                buf2[j] = buf3[j] = 0;
-            }
-            for (int j = 0; j < N; ++j) {
-                b[j] = displacementBufferx[i * N + j];
-                c[j] = displacementBuffery[i * N + j];
-            }
-            iterativeFFT(b, buf2);
-            iterativeFFT(c, buf3);
-            for (int j = 0; j < N; ++j) {
-                displacementBufferx[i * N + j] = buf2[j];
-                displacementBuffery[i * N + j] = buf3[j];
-            }
+void Ocean::setLoop(float period, int frames)
+{
+    producer.reset();
+    loop.reset();
+    simulator.setLoopPeriod(period);
+    query.clear();
+    if (period > 0.0f) {
+        try {
+            loop.reset(new OceanFrameCache(simulator, frames, fftMode));
+        } catch (...) {
+            simulator.setLoopPeriod(0.0f);
+            dropFrames();
+            updateProducer();
+            throw;
         }
+    }
+    dropFrames();
+    updateProducer();
+}
 
-        // Second round of FFT on columns
-        for (int i = 0; i < N; ++i) {
-            vector<complex<float>> a(N), buf(N);
-            for (int j = 0; j < N; ++j)
-                a[j] = HBuffer[j * N + i];
-            iterativeFFT(a, buf);
-            for (int j = 0; j < N; ++j) {
-                if ((i + j) % 2 == 0)
-                    HBuffer[j * N + i] = buf[j];
-                else
-                    HBuffer[j * N + i] = -buf[j];
-            }
-
-            vector<complex<float>> b(N), c(N), buf2(N), buf3(N);
-            for (int j = 0; j < N; ++j) {
-                b[j] = epsilonBufferx[j * N + i];
-                c[j] = epsilonBuffery[j * N + i];
-            }
-            iterativeFFT(b, buf2);
-            iterativeFFT(c, buf3);
-            for (int j = 0; j < N; ++j) {
-                if ((i + j) % 2 == 0) {
-                    epsilonBufferx[j * N + i] = buf2[j];
-                    epsilonBuffery[j * N + i] = buf3[j];
-                } else {
-                    epsilonBufferx[j * N + i] = -buf2[j];
-                    epsilonBuffery[j * N + i] = -buf3[j];
-                }
-            }
+void Ocean::playBaked(const std::string &path)
+{
+    baked.reset();
+    if (!path.empty()) {
+        baked.reset(new BakedOceanPlayer(path));
+        query.clear();
+    }
+    dropFrames();
+    updateProducer();
+}
 
-            for (int j = 0; j < N; ++j) {
-                buf2[j] = buf3[j] = 0;
-            }
-            for (int j = 0; j < N; ++j) {
-                b[j] = displacementBufferx[j * N + i];
-                c[j] = displacementBuffery[j * N + i];
-            }
-            iterativeFFT(b, buf2);
-            iterativeFFT(c, buf3);
-            for (int j = 0; j < N; ++j) {
-                if ((i + j) % 2 == 0) {
-                    displacementBufferx[j * N + i] = buf2[j];
-                    displacementBuffery[j * N + i] = buf3[j];
-                } else {
-                    displacementBufferx[j * N + i] = -buf2[j];
-                    displacementBuffery[j * N + i] = -buf3[j];
-                }
-            }
-        }
+void Ocean::setAsyncSimulation(bool enabled)
+{
+    asyncSimulation = enabled;
+    updateProducer();
+}
 
-        for (int i = 0; i < N; ++i) {
-            for (int j = 0; j < N; ++j) {
-                int index = i * N + j;
-                int pos = 3 * (i * N + j);
-
-                glm::vec3 heightVector = glm::vec3(-displacementBufferx[index].real(),
-                                                    HBuffer[i * N + j].real(),
-                                                   -displacementBuffery[index].real());
-                //std::cout << heightVector.x << " " << heightVector.y << " " << heightVector.z << std::endl;
-                heightVector = heightVector / 5.0f + glm::vec3(0.5f);
-                heightMapBuffer[pos + 0] = heightVector.x;
-                heightMapBuffer[pos + 1] = heightVector.y;
-                heightMapBuffer[pos + 2] = heightVector.z;
-                if (heightVector.x > 1.0 || heightVector.y > 1.0 || heightVector.z > 1.0
-                        || heightVector.x < 0.0 || heightVector.y < 0.0 || heightVector.z < 0.0) {
-                    std::cout << "Warning" << std::endl;
-                }
-                /*
-                float x = vertices[pos + 0], z = vertices[pos + 2];
-                vertices[pos + 0] = x - displacementBufferx[i * N + j].real();
-                vertices[pos + 1] = HBuffer[i * N + j].real();
-                vertices[pos + 2] = z - displacementBuffery[i * N + j].real();
-                */
-                glm::vec3 normal = glm::vec3(-epsilonBufferx[index].real(),
-                                              1.0f,
-                                             -epsilonBuffery[index].real());
-                normal = glm::normalize(normal) / 2.0f + glm::vec3(0.5f);
-                //std::cout << normal.x << " " << normal.y << " " << normal.z << std::endl;
-                normalMapBuffer[pos + 0] = normal.x;
-                normalMapBuffer[pos + 1] = normal.y;
-                normalMapBuffer[pos + 2] = normal.z;
+void Ocean::setSimulationRate(float rate)
+{
+    producer.reset();
+    simulationRate = std::max(rate, 0.0f);
+    // Fixed rate frames are exactly one step apart, so their phases can be
+    // rotated
+    simulator.setTimeStep(simulationRate > 0.0f ? 1.0f / simulationRate : timeStep);
+    dropFrames();
+    updateProducer();
+}
 
-            }
-        }
-        delete[] HBuffer;
-
-        // Setup height map and normal map
-        glBindTexture(GL_TEXTURE_2D, heightMap);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, N, N,
-                     0, GL_RGB, GL_FLOAT, heightMapBuffer);
-        glBindTexture(GL_TEXTURE_2D, normalMap);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, N, N,
-                     0, GL_RGB, GL_FLOAT, normalMapBuffer);
+void Ocean::setSurfaceQueries(bool enabled)
+{
+    producer.reset();
+    surfaceQueries = enabled;
+    if (!enabled)
+        query.clear();
+    updateProducer();
 }
 
-float Ocean::H(float x, float z, float t)
+void Ocean::updateProducer()
 {
-    using std::complex;
-    complex<float> result(0.0f, 0.0f);
-    for (int n = -N / 2; n < N / 2; ++n) {
-        for (int m = -N / 2; m < N / 2; ++m) {
-            int bufferIndex = (n + N/2) * N + m + N/2;
-            glm::vec2 k = kBuffer[bufferIndex];
-            float k_dot_x = glm::dot(k, glm::vec2(x, z));
-
-            result += hBuffer[bufferIndex] * complex<float>(cos(k_dot_x), sin(k_dot_x));
-        }
+    requestedFrame = NoFrame;
+    if (asyncSimulation && !loop && !baked) {
+        if (!producer)
+            producer.reset(new OceanProducer(simulator, surfaceQueries ? &query : nullptr));
+    } else {
+        producer.reset();
     }
-    return result.real();
 }
 
-std::complex<float> Ocean::h(glm::vec2 k, float t)
+void Ocean::setMapEncodings(MapEncoding height, MapEncoding normal)
 {
-    using std::complex;
-    complex<float> result(0.0f, 0.0f);
-    float omega_k = omega(k);
-    float coswt = cos(omega_k * t);
-    float sinwt = sin(omega_k * t);
-    result += h0(k) * complex<float>(coswt, sinwt);
-    result += std::conj(h0(-k)) * complex<float>(coswt, -sinwt);
-    return result;
+    heightFormat = heightMapFormat(height, heightRange);
+    normalFormat = normalMapFormat(normal);
+    // Both frames of a blend must decode their normals the same way
+    dropFrames();
 }
 
-std::complex<float> Ocean::h0(glm::vec2 k)
+void Ocean::setAutoRange(bool enabled)
 {
-    using std::complex;
-    float xi1 = normalRandom(), xi2 = normalRandom();
-    return (1.0f/sqrt(2.0f)) * complex<float>(xi1, xi2) * sqrt(Ph(k));
+    autoRange = enabled;
+    if (!enabled) {
+        heightRange = DefaultHeightRange;
+        heightFormat = heightMapFormat(heightFormat.encoding, heightRange);
+    }
 }
 
-float Ocean::normalRandom()
+void Ocean::setDecodeUniforms(const Shader &shader) const
 {
-    static auto seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    static std::default_random_engine generator((unsigned)seed);
-    static std::normal_distribution<float> dist(0.5, 0.1);
-    return dist(generator);
+    const MapTextures &from = textures[shown], &to = textures[next];
+    shader.setVec3("heightScale", glm::vec3(from.heightFormat.decodeScale()));
+    shader.setVec3("heightBias", glm::vec3(from.heightFormat.decodeBias()));
+    shader.setVec3("nextHeightScale", glm::vec3(to.heightFormat.decodeScale()));
+    shader.setVec3("nextHeightBias", glm::vec3(to.heightFormat.decodeBias()));
+    shader.setFloat("normalScale", from.normalFormat.decodeScale());
+    shader.setFloat("normalBias", from.normalFormat.decodeBias());
+    shader.setBool("normalFromXZ", from.normalFormat.encoding == MapEncoding::RG16Snorm);
+    shader.setFloat("frameBlend", blend);
 }
 
-float Ocean::Ph(glm::vec2 k)
+void Ocean::setStreamingUpload(bool enabled)
 {
-    if (glm::length(k) < 0.001f) return 0.0f;
-    float absk = glm::length(k);
-    float L = glm::length(w)*glm::length(w) / g;
-    float result = A;
-    result *= exp(-1.0f/((absk*L)*(absk*L))) / pow(absk, 4);
-    result *= pow(glm::dot(glm::normalize(k), glm::normalize(w)), 2);
-    return result;
+    streaming = enabled;
 }
 
-float Ocean::omega(glm::vec2 k)
+void Ocean::generateWave(float time)
 {
-    float klen = glm::length(k);
-    return sqrt(g * klen);
+    using Clock = std::chrono::steady_clock;
+    auto waveStart = Clock::now();
+    if (simulationRate > 0.0f && !loop && !baked)
+        generateFixedRate(time);
+    else
+        generateFrame(time);
+    report.wave.add(std::chrono::duration<double, std::milli>(Clock::now() - waveStart).count());
+    lastWaveTime = time;
 }
 
-glm::vec3 Ocean::epsilon(float x, float z, float t)
+void Ocean::generateFrame(float time)
 {
-    using std::complex;
-    glm::vec3 result(0.0f, 0.0f, 0.0f);
-    for (int n = -N / 2; n < N / 2; ++n) {
-        for (int m = -N / 2; m < N / 2; ++m) {
-            int bufferIndex = (n + N/2) * N + m + N/2;
-            glm::vec2 k = kBuffer[bufferIndex];
-            float k_dot_x = glm::dot(glm::vec2(x, z), k);
-
-            complex<float> tmp = hBuffer[bufferIndex]
-                                 * complex<float>(cos(k_dot_x), sin(k_dot_x));
-
-            glm::vec2 v = -tmp.imag() * k;
-            result.x += v.x;
-            result.z += v.y;
+    // Loops and baked animations keep their frames as RGB32F maps
+    MapFormat floatHeights = heightMapFormat(MapEncoding::RGB32F);
+    MapFormat floatNormals = normalMapFormat(MapEncoding::RGB32F);
+    MapTextures &target = textures[0];
+    target.frame = NoFrame;
+    shown = next = 0;
+    blend = 0.0f;
+    showTextures();
+    if (baked) {
+        const float *heights, *normals;
+        baked->acquire(baked->frameAt(time), heights, normals);
+        uploadFrame(target, baked->file().resolution(), floatHeights, floatNormals, heights, normals);
+    } else if (loop) {
+        uploadFrame(target, N, floatHeights, floatNormals, nullptr, nullptr, [&](void *heights, void *normals) {
+            loop->sample(time, static_cast<float *>(heights), static_cast<float *>(normals), simulator.threadPool());
+        });
+    } else if (producer) {
+        // The frame one call ahead, so it is ready when it is due
+        float ahead = lastWaveTime >= 0.0f ? std::max(time - lastWaveTime, 0.0f) : 0.0f;
+        producer->request(time + ahead, fftMode, heightFormat, normalFormat);
+        const OceanFrame *frame = producer->latest();
+        if (!frame) {
+            // Keep showing the last one rather than wait
+            ++report.staleFrames;
+            return;
         }
+        uploadProducedFrame(target, *frame);
+    } else {
+        simulateFrame(target, time);
     }
-    return result;
 }
 
-glm::vec3 Ocean::D(float x, float z, float t)
+void Ocean::generateFixedRate(float time)
 {
-    using std::complex;
-    glm::vec3 result(0.0f, 0.0f, 0.0f);
-    for (int n = -N / 2; n < N / 2; ++n) {
-        for (int m = -N / 2; m < N / 2; ++m) {
-            int bufferIndex = (n + N/2) * N + m + N/2;
-            glm::vec2 k = kBuffer[bufferIndex];
-            float k_dot_x = glm::dot(glm::vec2(x, z), k);
-
-            complex<float> tmp = hBuffer[bufferIndex]
-                                 * complex<float>(sin(k_dot_x), -cos(k_dot_x));
-
-            glm::vec2 v = (tmp.real()/glm::length(k)) * k;
-            result.x += v.x;
-            result.z += v.y;
+    double position = (double)time * simulationRate;
+    auto frame = (long long)std::floor(position);
+    auto holding = [this](long long f) {
+        for (int i = 0; i < 2; ++i)
+            if (textures[i].frame == f)
+                return i;
+        return -1;
+    };
+    auto timeOf = [this](long long f) { return (float)(f / (double)simulationRate); };
+    // The frames around time, the earlier one first as it is shown alone
+    // until the later one is ready
+    for (long long f : {frame, frame + 1}) {
+        if (holding(f) >= 0)
+            continue;
+        // Replaces whichever pair does not hold the other frame
+        int target = holding(f == frame ? frame + 1 : frame) == 0 ? 1 : 0;
+        float frameTime = timeOf(f);
+        if (producer) {
+            if (requestedFrame != f) {
+                producer->request(frameTime, fftMode, heightFormat, normalFormat);
+                requestedFrame = f;
+            }
+            const OceanFrame *produced = producer->latest();
+            if (!produced || produced->time != frameTime
+                    || produced->normalFormat.encoding != normalFormat.encoding)
+                break;
+            uploadProducedFrame(textures[target], *produced);
+        } else {
+            simulateFrame(textures[target], frameTime);
+        }
+        textures[target].frame = f;
+    }
+
+    int from = holding(frame), to = holding(frame + 1);
+    if (from >= 0 && to >= 0) {
+        shown = from, next = to;
+        blend = (float)(position - frame);
+        // The frame needed next, which waits in the producer until then
+        if (producer && requestedFrame != frame + 2) {
+            producer->request(timeOf(frame + 2), fftMode, heightFormat, normalFormat);
+            requestedFrame = frame + 2;
         }
+    } else {
+        // Whatever is closest to time until both are there
+        ++report.staleFrames;
+        shown = next = from >= 0 ? from : to >= 0 ? to : shown;
+        blend = 0.0f;
     }
-    return result;
+    showTextures();
 }
 
+void Ocean::simulateFrame(MapTextures &target, float time)
+{
+    using Clock = std::chrono::steady_clock;
+    simulator.simulate(time, fftMode);
+    uploadFrame(target, N, heightFormat, normalFormat, nullptr, nullptr, [&](void *heights, void *normals) {
+        auto packStart = Clock::now();
+        stats = simulator.packTextures(heightFormat, heights, normalFormat, normals);
+        double packMs = std::chrono::duration<double, std::milli>(Clock::now() - packStart).count();
+        const OceanTimings &timings = simulator.timings();
+        report.simulation.add(timings.spectrum + timings.transform + packMs);
+    });
+    if (surfaceQueries)
+        query.publish(simulator, time);
+    adaptHeightRange();
+}
 
+void Ocean::uploadProducedFrame(MapTextures &target, const OceanFrame &frame)
+{
+    stats = frame.stats;
+    report.simulation.add(frame.simulateTime);
+    report.latency.add(1000.0 * frame.latency);
+    uploadFrame(target, N, frame.heightFormat, frame.normalFormat, frame.heightMap, frame.normalMap);
+    adaptHeightRange();
+}
 
+void Ocean::adaptHeightRange()
+{
+    if (!autoRange)
+        return;
+    glm::vec3 extreme = glm::max(glm::abs(stats.minimum), glm::abs(stats.maximum));
+    float target = std::max(AutoRangeMargin * std::max(extreme.x, std::max(extreme.y, extreme.z)),
+                            MinimumHeightRange);
+    // Grows at once, as the next frame would clip otherwise
+    heightRange = std::max(target, heightRange * AutoRangeDecay);
+    heightFormat = heightMapFormat(heightFormat.encoding, heightRange);
+}
 
+void Ocean::dropFrames()
+{
+    for (auto &pair : textures)
+        pair.frame = NoFrame;
+    requestedFrame = NoFrame;
+}
 
+void Ocean::showTextures()
+{
+    heightMap = textures[shown].height;
+    normalMap = textures[shown].normal;
+    nextHeightMap = textures[next].height;
+    nextNormalMap = textures[next].normal;
+}
+
+template <typename Fill>
+void Ocean::uploadFrame(MapTextures &target, int size, const MapFormat &heightDataFormat,
+                        const MapFormat &normalDataFormat, const void *heights, const void *normals,
+                        const Fill &fill)
+{
+    using Clock = std::chrono::steady_clock;
+    allocateTextures(target, size, heightDataFormat, normalDataFormat);
+
+    auto uploadStart = Clock::now();
+    void *heightData = heightMapBuffer, *normalData = normalMapBuffer;
+    if (streaming)
+        mapUploadBuffer(target, heightData, normalData);
+    double uploadMs = std::chrono::duration<double, std::milli>(Clock::now() - uploadStart).count();
+
+    if (heights) {
+        if (streaming) {
+            size_t texels = (size_t)size * size;
+            std::memcpy(heightData, heights, mapTexelSize(heightDataFormat.encoding) * texels);
+            std::memcpy(normalData, normals, mapTexelSize(normalDataFormat.encoding) * texels);
+        } else {
+            // Uploaded from where they were decoded or packed
+            heightData = const_cast<void *>(heights);
+            normalData = const_cast<void *>(normals);
+        }
+    } else {
+        fill(heightData, normalData);
+    }
 
+    uploadStart = Clock::now();
+    uploadMaps(target, heightData, normalData);
+    uploadMs += std::chrono::duration<double, std::milli>(Clock::now() - uploadStart).count();
+    lastUploadTime = uploadMs;
+}
 
+void Ocean::uploadFrame(MapTextures &target, int size, const MapFormat &heightDataFormat,
+                        const MapFormat &normalDataFormat, const void *heights, const void *normals)
+{
+    uploadFrame(target, size, heightDataFormat, normalDataFormat, heights, normals, [](void *, void *) {});
+}
 
+void Ocean::allocateTextures(MapTextures &target, int size, const MapFormat &heightDataFormat,
+                             const MapFormat &normalDataFormat)
+{
+    if (size != target.size || heightDataFormat.encoding != target.heightFormat.encoding
+            || normalDataFormat.encoding != target.normalFormat.encoding) {
+        GLint internalFormat;
+        GLenum format, type;
+        textureFormat(heightDataFormat.encoding, internalFormat, format, type);
+        glBindTexture(GL_TEXTURE_2D, target.height);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size,
+                     0, format, type, nullptr);
+        textureFormat(normalDataFormat.encoding, internalFormat, format, type);
+        glBindTexture(GL_TEXTURE_2D, target.normal);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size,
+                     0, format, type, nullptr);
+        target.size = size;
+    }
+    // The scale and bias can change every frame without new storage
+    target.heightFormat = heightDataFormat;
+    target.normalFormat = normalDataFormat;
+}
+
+void Ocean::mapUploadBuffer(const MapTextures &target, void *&heightMapData, void *&normalMapData)
+{
+    UploadBuffer &upload = uploadBuffers[nextUploadBuffer];
+    // The texture update that last read this buffer may still be running
+    if (upload.fence) {
+        while (glClientWaitSync(upload.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(upload.fence);
+        upload.fence = nullptr;
+    }
+    size_t texels = (size_t)target.size * target.size;
+    size_t heightBytes = mapTexelSize(target.heightFormat.encoding) * texels;
+    size_t bytes = heightBytes + mapTexelSize(target.normalFormat.encoding) * texels;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+    if (upload.size < bytes) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        upload.size = bytes;
+    }
+    // The fence already ordered this write after the last read, so the
+    // driver need not synchronize the mapping
+    auto *data = static_cast<char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                                      GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!data)
+        throw std::runtime_error("Ocean: cannot map the upload buffer");
+    heightMapData = data;
+    normalMapData = data + heightBytes;
+}
+
+void Ocean::uploadMaps(const MapTextures &target, const void *heightMapData, const void *normalMapData)
+{
+    if (streaming) {
+        UploadBuffer &upload = uploadBuffers[nextUploadBuffer];
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        // The maps become offsets into the bound buffer
+        size_t heightBytes = mapTexelSize(target.heightFormat.encoding) * target.size * target.size;
+        heightMapData = nullptr;
+        normalMapData = reinterpret_cast<const void *>(heightBytes);
+    }
+    GLint internalFormat;
+    GLenum format, type;
+    // Setup height map and normal map
+    textureFormat(target.heightFormat.encoding, internalFormat, format, type);
+    glBindTexture(GL_TEXTURE_2D, target.height);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, target.size, target.size, format, type, heightMapData);
+    textureFormat(target.normalFormat.encoding, internalFormat, format, type);
+    glBindTexture(GL_TEXTURE_2D, target.normal);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, target.size, target.size, format, type, normalMapData);
+    if (streaming) {
+        UploadBuffer &upload = uploadBuffers[nextUploadBuffer];
+        upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        nextUploadBuffer = (nextUploadBuffer + 1) % UploadBufferCount;
+    }
+}
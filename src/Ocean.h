@@ -13,24 +13,138 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include <complex>
+#include <memory>
+#include <string>
+
+#include "BakedOcean.h"
+#include "OceanFrameCache.h"
+#include "OceanProducer.h"
+#include "OceanQuery.h"
+#include "OceanSimulator.h"
+#include "Shader.h"
+#include "TextureEncoding.h"
 
 #include <glad/glad.h>
 
+// Where generateWave spends its time, in milliseconds
+struct OceanTimingReport
+{
+    // generateWave on the calling thread, the render thread of the viewer
+    TimingStats wave;
+    // Simulating and packing a frame, on whichever thread does it
+    TimingStats simulation;
+    // From asking the producer for a frame to it being packed
+    TimingStats latency;
+    // Calls of generateWave with no new frame to upload
+    long long staleFrames = 0;
+};
+
 /*
- * The class that describe an Ocean
+ * The class that describe an Ocean. The waves are simulated by
+ * OceanSimulator on the CPU, this class uploads them as textures.
  */
 class Ocean
 {
 public:
+    // resolution must be at least 8 and even, with no prime factors other than
+    // 2, 3 and 5. Needs a current GL context.
     Ocean(glm::vec2 wind, int resolution, float amplitude);
     ~Ocean();
 
     // Given current time, generate wave
     void generateWave(float time);
 
+    // Number of threads generateWave splits its work across, including the
+    // calling one. 0 uses one per hardware thread, which is the default.
+    void setThreadCount(int threads);
+
+    // Changes the wind and the wave amplitude. The initial spectrum is
+    // recomputed from the same random numbers, so the waves keep their shape.
+    void setParameters(glm::vec2 wind, float amplitude);
+
+    // Lets generateWave advance the wave phases by rotating them when it is
+    // called with times exactly step apart. See OceanSimulator::setTimeStep.
+    void setTimeStep(float step);
+
+    // Makes the ocean repeat every period seconds and precomputes frames
+    // evenly spaced over it, which generateWave then interpolates instead of
+    // simulating. Costs 24*N*N bytes per frame. A period of 0 goes back to
+    // simulating every frame, the default. Throws std::invalid_argument if
+    // the period is positive and frames is less than 1, which leaves the
+    // ocean simulating every frame.
+    void setLoop(float period, int frames);
+
+    // Plays the baked animation at path instead of simulating, at the cost
+    // of decoding and uploading its maps. The maps have the resolution of
+    // the file. An empty path goes back to simulating. Throws
+    // std::runtime_error if the file cannot be read.
+    void playBaked(const std::string &path);
+
+    // Selects the texture formats the simulated maps are uploaded in, both
+    // RGB32F by default. The smaller formats cut the upload to a third or
+    // less; loops and baked animations stay RGB32F. Throws
+    // std::invalid_argument for a height map of RG16Snorm.
+    void setMapEncodings(MapEncoding height, MapEncoding normal);
+
+    // Lets the range of the height map follow the waves. Every frame is
+    // packed with the largest height or displacement of the last one plus a
+    // margin, so unorm maps keep their precision on calm seas and stop
+    // clipping rough ones. Off by default, where the range is 2.5.
+    void setAutoRange(bool enabled);
+
+    // What packing the last simulated frame saw in its height map
+    const OceanMapStats &mapStats() const { return stats; }
+
+    // Uploads the maps through a ring of pixel buffers, which generateWave
+    // packs straight into and the driver copies to the textures
+    // asynchronously, instead of from client memory, which the upload call
+    // has to copy before it returns. Buffers are mapped and unmapped every
+    // frame, which on the drivers measured so far costs more than the copy
+    // saves, so it is off by default.
+    void setStreamingUpload(bool enabled);
+
+    // Simulates rate frames per second, at multiples of 1 / rate, and
+    // blends the two around the time of every generateWave in the shaders,
+    // so the simulation no longer runs at the frame rate of the renderer.
+    // A rate of 0 simulates every call of generateWave, the default. Loops
+    // and baked animations ignore it.
+    void setSimulationRate(float rate);
+
+    // Simulates on a producer thread instead of in generateWave, which then
+    // asks for the frame one call ahead and uploads the latest finished one
+    // without waiting for it. Off by default.
+    void setAsyncSimulation(bool enabled);
+
+    // Publishes every simulated frame to surface(), which costs a copy of
+    // its fields. Loops and baked animations are not simulated frame by
+    // frame, so the surface is flat while they play. Off by default.
+    void setSurfaceQueries(bool enabled);
+
+    // Heights, normals and velocities at any points, which gameplay code
+    // may sample from its own threads at the times it passes to
+    // generateWave
+    const OceanQuery &surface() const { return query; }
+
+    const OceanTimingReport &timingReport() const { return report; }
+
+    void resetTimingReport() { report = OceanTimingReport(); }
+
+    // Milliseconds generateWave last spent in GL upload calls: mapping a
+    // pixel buffer, waiting for it to be free, and updating the textures
+    double uploadTime() const { return lastUploadTime; }
+
+    // Sets the uniforms that decode the maps last uploaded on shader, which
+    // must be in use: vec3 heightScale and heightBias, float normalScale and
+    // normalBias, and bool normalFromXZ when the normal y is reconstructed,
+    // as well as vec3 nextHeightScale and nextHeightBias of the next maps
+    // and float frameBlend, how far to blend from the maps to the next ones
+    void setDecodeUniforms(const Shader &shader) const;
+
     // The texture used to store selected heights
     unsigned int heightMap, normalMap;
+    // The maps of the frame after, which the shaders blend towards at a
+    // fixed simulation rate, and the same textures otherwise
+    unsigned int nextHeightMap, nextNormalMap;
     // The 3*N*N array to store final vertices position and indice information
     int vertexCount;
     float *vertices;
@@ -38,48 +152,125 @@ public:
     unsigned int *indices;
     // The flag to control generating method
     bool useFFT;
+    // How the spectra are transformed (Complex, Real or Packed), Real by default
+    FFTMode fftMode;
 private:
-    float g;
-    float PI;
-    float unitWidth;
-    // Choppiness of the wave
-    float choppy;
     // Resolution
     int N;
-    // Water Length
-    int L;
-    // Wave height amplitude parameter
-    float A;
-    // Wind direction and speed in one vector
-    glm::vec2 w;
-    // the buffer to store computed results
-    std::complex<float> *hBuffer;
-    glm::vec2 *kBuffer;
-    std::complex<float> *epsilonBufferx;
-    std::complex<float> *epsilonBuffery;
-    std::complex<float> *displacementBufferx;
-    std::complex<float> *displacementBuffery;
+    OceanSimulator simulator;
+    // The frames of the loop, if there is one
+    std::unique_ptr<OceanFrameCache> loop;
+    // The baked animation being played, if there is one
+    std::unique_ptr<BakedOceanPlayer> baked;
+    // Simulated frames for surface queries, if they are on. Declared
+    // before the producer, which publishes to it.
+    OceanQuery query;
+    bool surfaceQueries;
+    // The simulation thread when it is on and simulating. Declared after
+    // the simulator, so it stops before the simulator goes away.
+    std::unique_ptr<OceanProducer> producer;
+    bool asyncSimulation;
+    // Time of the last generateWave, -1 before the first
+    float lastWaveTime;
+    OceanTimingReport report;
 
+    // The textures as packed on the CPU, before they are uploaded. They hold
+    // 3*N*N floats, which fits the texels of every encoding.
     float *heightMapBuffer;
     float *normalMapBuffer;
+    // The formats simulated maps are packed in
+    MapFormat heightFormat, normalFormat;
+    // Heights and displacements the height map covers, as in heightMapFormat
+    float heightRange;
+    bool autoRange;
+    OceanMapStats stats;
+
+    // A height map and a normal map, with the size and formats of what was
+    // uploaded to them
+    struct MapTextures
+    {
+        unsigned int height, normal;
+        // Size of the texture storage, 0 before it is allocated
+        int size;
+        MapFormat heightFormat, normalFormat;
+        // The fixed rate frame they hold, -1 for none
+        long long frame;
+    };
+    MapTextures textures[2];
+    // The maps shown and blended towards, and how far
+    int shown, next;
+    float blend;
+    // Frames per second of setSimulationRate, and the step of setTimeStep
+    // to go back to without one
+    float simulationRate;
+    float timeStep;
+    // The fixed rate frame last asked of the producer
+    long long requestedFrame;
+
+    // A pixel buffer holding the height map then the normal map, and the
+    // fence of the last upload from it
+    struct UploadBuffer
+    {
+        unsigned int buffer;
+        size_t size;
+        GLsync fence;
+    };
+    static const int UploadBufferCount = 3;
+    UploadBuffer uploadBuffers[UploadBufferCount];
+    int nextUploadBuffer;
+    bool streaming;
+    double lastUploadTime;
+
+    // Starts the producer if simulation is async and simulated at all, and
+    // stops it otherwise. Anything else using the simulator stops it first.
+    void updateProducer();
+
+    // generateWave when every call shows a frame of its own
+    void generateFrame(float time);
+
+    // generateWave at a fixed simulation rate: makes sure the frames before
+    // and after time are in the textures and sets the blend between them
+    void generateFixedRate(float time);
+
+    // Simulates the maps at time into target
+    void simulateFrame(MapTextures &target, float time);
 
-    // Returns height
-    float H(float x, float z, float t);
+    // Uploads a frame of the producer to target
+    void uploadProducedFrame(MapTextures &target, const OceanFrame &frame);
 
-    std::complex<float> h(glm::vec2 k, float t);
+    // Forgets the fixed rate frames in the textures, which no longer match
+    // the simulation
+    void dropFrames();
 
-    std::complex<float> h0(glm::vec2 k);
+    // Points heightMap, normalMap and the next maps at the textures shown
+    void showTextures();
 
-    inline float normalRandom();
+    // Uploads size*size maps of the given formats to target. heights and
+    // normals are used if not null, otherwise fill writes them to where
+    // they are uploaded from.
+    void uploadFrame(MapTextures &target, int size, const MapFormat &heightDataFormat,
+                     const MapFormat &normalDataFormat, const void *heights, const void *normals);
+    template <typename Fill>
+    void uploadFrame(MapTextures &target, int size, const MapFormat &heightDataFormat,
+                     const MapFormat &normalDataFormat, const void *heights, const void *normals,
+                     const Fill &fill);
 
-    inline float Ph(glm::vec2 k);
+    // Picks the height range of the next frame from the stats of this one
+    void adaptHeightRange();
 
-    inline float omega(glm::vec2 k);
+    // Allocates the storage of size*size textures of the given formats,
+    // unless they already have it, so that uploads only replace texels
+    void allocateTextures(MapTextures &target, int size, const MapFormat &heightDataFormat,
+                          const MapFormat &normalDataFormat);
 
-    glm::vec3 epsilon(float x, float z, float t);
+    // Maps the next pixel buffer, after waiting for its last upload, and
+    // points the maps at where they go in it. Throws std::runtime_error if
+    // the buffer cannot be mapped.
+    void mapUploadBuffer(const MapTextures &target, void *&heightMapData, void *&normalMapData);
 
-    // Returns displacement vector
-    glm::vec3 D(float x, float z, float t);
+    // Updates the textures of target from the maps, or from the mapped pixel
+    // buffer when streaming, which the maps are then ignored for
+    void uploadMaps(const MapTextures &target, const void *heightMapData, const void *normalMapData);
 };
 
 
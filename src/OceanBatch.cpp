@@ -0,0 +1,366 @@
+//
+// Runs the ocean simulation offline, without a window or a GPU
+//
+// Every frame of a time range is simulated with OceanSimulator, the time
+// of each stage is reported at the end and the fields can be streamed to a
+// file for later use. --bake also writes the texture maps of every frame as
+// a baked animation the Ocean viewer can play back. --latency instead paces
+// the frames in real time like a renderer, and compares how long each one
+// holds up the loop when it simulates itself and when an OceanProducer
+// simulates on its own thread.
+//
+// The output file starts with a header of
+//   char   magic[8]    "OCEANRAW"
+//   int32  version     1
+//   int32  resolution  N
+//   int32  frames
+//   float  length      side of the simulated patch
+//   float  start, step time of the first frame and between two frames
+// followed by every frame as five N*N row-major float planes: height,
+// displacement x and z, slope x and z, in the byte order of the machine.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BakedOcean.h"
+#include "OceanProducer.h"
+#include "OceanSimulator.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+
+struct BatchOptions
+{
+    int resolution = 128;
+    glm::vec2 wind = glm::vec2(2.0f, 2.0f);
+    float amplitude = 0.02f;
+    // The time scale of the Ocean viewer
+    float timeScale = 0.5f;
+    unsigned seed = 1;
+    float start = 0.0f;
+    float end = 10.0f;
+    float step = 1.0f / 60.0f;
+    // 0 for one per hardware thread
+    int threads = 0;
+    FFTMode mode = FFTMode::Real;
+    // Empty to only time the simulation
+    string output;
+    // Baked animation, none if empty
+    string bake;
+    BakedEncoding encoding = BakedEncoding::Half;
+    BakedCompression compression = BakedCompression::None;
+    // Measure the render loop latency instead of the stages
+    bool latency = false;
+};
+
+// Mean, minimum and maximum of the times of one stage
+struct StageTimes
+{
+    double total = 0.0;
+    double best = 1e30;
+    double worst = 0.0;
+
+    void add(double ms)
+    {
+        total += ms;
+        best = min(best, ms);
+        worst = max(worst, ms);
+    }
+};
+
+const char Usage[] =
+        " [--resolution n] [--wind x z] [--amplitude a] [--time-scale s] [--seed s]\n"
+        "       [--start t] [--end t] [--step dt] [--threads n] [--mode complex|real|packed]\n"
+        "       [--output file] [--bake file [--encoding half|int16] [--compress]] [--latency]";
+
+bool parseMode(const char *name, FFTMode &mode)
+{
+    if (strcmp(name, "complex") == 0)
+        mode = FFTMode::Complex;
+    else if (strcmp(name, "real") == 0)
+        mode = FFTMode::Real;
+    else if (strcmp(name, "packed") == 0)
+        mode = FFTMode::Packed;
+    else
+        return false;
+    return true;
+}
+
+bool parseOptions(int argc, char **argv, BatchOptions &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        // Number of values that follow the option
+        int left = argc - i - 1;
+        if (strcmp(argv[i], "--resolution") == 0 && left >= 1) {
+            options.resolution = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--wind") == 0 && left >= 2) {
+            options.wind.x = (float)atof(argv[++i]);
+            options.wind.y = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--amplitude") == 0 && left >= 1) {
+            options.amplitude = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--time-scale") == 0 && left >= 1) {
+            options.timeScale = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && left >= 1) {
+            options.seed = (unsigned)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--start") == 0 && left >= 1) {
+            options.start = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--end") == 0 && left >= 1) {
+            options.end = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--step") == 0 && left >= 1) {
+            options.step = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && left >= 1) {
+            options.threads = max(0, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--mode") == 0 && left >= 1) {
+            if (!parseMode(argv[++i], options.mode))
+                return false;
+        } else if (strcmp(argv[i], "--output") == 0 && left >= 1) {
+            options.output = argv[++i];
+        } else if (strcmp(argv[i], "--bake") == 0 && left >= 1) {
+            options.bake = argv[++i];
+        } else if (strcmp(argv[i], "--encoding") == 0 && left >= 1) {
+            ++i;
+            if (strcmp(argv[i], "half") == 0)
+                options.encoding = BakedEncoding::Half;
+            else if (strcmp(argv[i], "int16") == 0)
+                options.encoding = BakedEncoding::Int16;
+            else
+                return false;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            options.compression = BakedCompression::LZ4;
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            options.latency = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The resolutions OceanSimulator accepts. Below 8 its patch length N / 8
+// is 0 and the wave vectors are not finite.
+bool validResolution(int n)
+{
+    if (n < 8 || n % 2 != 0)
+        return false;
+    for (int factor : {2, 3, 5})
+        while (n % factor == 0)
+            n /= factor;
+    return n == 1;
+}
+
+// Copies a field of the simulator into a dense N*N plane
+void copyField(const float *field, const OceanFields &f, int n, float *plane, ThreadPool *pool)
+{
+    pool->parallelFor(n, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; ++i) {
+            const float *row = field + i * f.rowStride;
+            float *out = plane + i * n;
+            for (int j = 0; j < n; ++j)
+                out[j] = row[j * f.step];
+        }
+    });
+}
+
+template <typename T>
+void writeValue(ofstream &file, T value)
+{
+    file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void report(const char *name, const StageTimes &times, int frames)
+{
+    cout << "  " << name << string(12 - strlen(name), ' ')
+         << times.total / frames << " ms mean, " << times.best << " ms min, "
+         << times.worst << " ms max" << endl;
+}
+
+void report(const char *name, const TimingStats &times)
+{
+    cout << "  " << name << string(12 - strlen(name), ' ')
+         << times.mean() << " ms mean, " << times.jitter() << " ms jitter, "
+         << times.worst << " ms max" << endl;
+}
+
+// Runs the frames at their times in real time, once simulating them in the
+// loop and once on a producer, and reports how long every frame held the
+// loop up and how late it started
+void measureLatency(OceanSimulator &simulator, const BatchOptions &options, int frames)
+{
+    using clock = chrono::steady_clock;
+    const int n = options.resolution;
+    MapFormat heightFormat = heightMapFormat(MapEncoding::RGB32F), normalFormat = normalMapFormat(MapEncoding::RGB32F);
+    vector<float> heightMap(3 * (size_t)n * n), normalMap(3 * (size_t)n * n);
+    for (bool async : {false, true}) {
+        unique_ptr<OceanProducer> producer;
+        if (async)
+            producer.reset(new OceanProducer(simulator));
+        TimingStats blocked, late;
+        long long stale = 0;
+        auto start = clock::now();
+        for (int i = 0; i < frames; ++i) {
+            auto due = start + chrono::duration_cast<clock::duration>(chrono::duration<double>(i * options.step));
+            this_thread::sleep_until(due);
+            float time = options.start + i * options.step;
+            auto frameStart = clock::now();
+            if (producer) {
+                // The frame after this one, like Ocean
+                producer->request(time + options.step, options.mode, heightFormat, normalFormat);
+                if (!producer->latest())
+                    ++stale;
+            } else {
+                simulator.simulate(time, options.mode);
+                simulator.packTextures(heightFormat, heightMap.data(), normalFormat, normalMap.data());
+            }
+            auto frameEnd = clock::now();
+            blocked.add(chrono::duration<double, milli>(frameEnd - frameStart).count());
+            late.add(chrono::duration<double, milli>(frameStart - due).count());
+        }
+        cout << (async ? "Producer thread" : "In the loop") << ", " << frames << " frames of " << n << "x" << n
+             << " every " << 1000.0 * options.step << " ms" << endl;
+        report("blocked", blocked);
+        report("late", late);
+        if (async)
+            cout << "  " << stale << " frames without a new wave" << endl;
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    BatchOptions options;
+    if (!parseOptions(argc, argv, options) || options.step <= 0.0f || options.end < options.start) {
+        cerr << "Usage: " << argv[0] << Usage << endl;
+        return 1;
+    }
+    if (!validResolution(options.resolution)) {
+        cerr << "The resolution must be at least 8 and even, with no prime factors other than 2, 3 and 5" << endl;
+        return 1;
+    }
+    const int n = options.resolution;
+    // Frames at start, start + step, ... up to and including end
+    const int frames = (int)floor((options.end - options.start) / options.step + 1e-4) + 1;
+
+    OceanSimulator simulator(options.wind, n, options.amplitude, options.timeScale);
+    simulator.setSeed(options.seed);
+    simulator.setThreadCount(options.threads);
+    simulator.setTimeStep(options.step);
+    if (options.latency) {
+        measureLatency(simulator, options, frames);
+        return 0;
+    }
+
+    ofstream file;
+    vector<float> frame;
+    if (!options.output.empty()) {
+        file.open(options.output, ios::binary);
+        if (!file) {
+            cerr << "Cannot write " << options.output << endl;
+            return 1;
+        }
+        file.write("OCEANRAW", 8);
+        writeValue<int32_t>(file, 1);
+        writeValue<int32_t>(file, n);
+        writeValue<int32_t>(file, frames);
+        writeValue<float>(file, (float)simulator.length());
+        writeValue<float>(file, options.start);
+        writeValue<float>(file, options.step);
+        frame.resize(5 * (size_t)n * n);
+    }
+
+    unique_ptr<BakedOceanWriter> baker;
+    vector<float> heightMap, normalMap;
+    if (!options.bake.empty()) {
+        try {
+            baker.reset(new BakedOceanWriter(options.bake, bakedOceanHeader(
+                    n, (float)simulator.length(), options.wind, options.amplitude, 1.0f / options.step,
+                    options.encoding, options.compression)));
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        heightMap.resize(3 * (size_t)n * n);
+        normalMap.resize(3 * (size_t)n * n);
+    }
+
+    using clock = chrono::steady_clock;
+    StageTimes spectrum, transform, pack, write, bake, total;
+    // Texels of the baked height maps outside [0, 1], which int16 clamps
+    long long clipped = 0;
+    auto batchStart = clock::now();
+    for (int i = 0; i < frames; ++i) {
+        // Times are computed rather than accumulated, so every frame is
+        // exactly one step after the last and the phases can be rotated
+        float time = options.start + i * options.step;
+        auto frameStart = clock::now();
+        simulator.simulate(time, options.mode);
+        spectrum.add(simulator.timings().spectrum);
+        transform.add(simulator.timings().transform);
+        if (file.is_open()) {
+            auto packStart = clock::now();
+            OceanFields f = simulator.fields();
+            size_t plane = (size_t)n * n;
+            const float *fields[] = {f.height, f.dispX, f.dispZ, f.slopeX, f.slopeZ};
+            for (int k = 0; k < 5; ++k)
+                copyField(fields[k], f, n, frame.data() + k * plane, simulator.threadPool());
+            auto writeStart = clock::now();
+            file.write(reinterpret_cast<const char *>(frame.data()), frame.size() * sizeof(float));
+            pack.add(chrono::duration<double, milli>(writeStart - packStart).count());
+            write.add(chrono::duration<double, milli>(clock::now() - writeStart).count());
+        }
+        if (baker) {
+            auto bakeStart = clock::now();
+            clipped += simulator.packTextures(heightMap.data(), normalMap.data()).clipped;
+            baker->write(heightMap.data(), normalMap.data());
+            bake.add(chrono::duration<double, milli>(clock::now() - bakeStart).count());
+        }
+        total.add(chrono::duration<double, milli>(clock::now() - frameStart).count());
+    }
+    double seconds = chrono::duration<double>(clock::now() - batchStart).count();
+    if (baker) {
+        try {
+            baker->finish();
+        } catch (const exception &e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+    if (file.is_open()) {
+        file.close();
+        if (!file) {
+            cerr << "Writing " << options.output << " failed" << endl;
+            return 1;
+        }
+    }
+
+    cout << frames << " frames of " << n << "x" << n << " with "
+         << simulator.threadPool()->size() << " threads in " << seconds << " s, "
+         << frames / seconds << " frames/s, "
+         << (double)frames * n * n / seconds * 1e-6 << " Mpoints/s" << endl;
+    report("spectrum", spectrum, frames);
+    report("transform", transform, frames);
+    if (!options.output.empty()) {
+        report("pack", pack, frames);
+        report("write", write, frames);
+    }
+    if (baker) {
+        report("bake", bake, frames);
+        if (clipped > 0)
+            cout << clipped << " height map texels out of range" << endl;
+    }
+    report("total", total, frames);
+    return 0;
+}
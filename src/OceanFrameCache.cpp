@@ -0,0 +1,55 @@
+//
+// Precomputed frames of a looping ocean
+//
+
+#include "OceanFrameCache.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <stdexcept>
+
+OceanFrameCache::OceanFrameCache(OceanSimulator &simulator, int frames, FFTMode mode)
+        : N(simulator.size()), frames(frames), loopPeriod(simulator.loopPeriod()),
+          frameSize(3 * (size_t)N * N)
+{
+    if (frames < 1)
+        throw std::invalid_argument("OceanFrameCache: needs at least one frame");
+    if (!(loopPeriod > 0.0f))
+        throw std::invalid_argument("OceanFrameCache: the simulator has no loop period");
+    heightMaps = allocateAlignedArray<float>(frames * frameSize);
+    normalMaps = allocateAlignedArray<float>(frames * frameSize);
+    for (int frame = 0; frame < frames; ++frame) {
+        simulator.simulate(loopPeriod * frame / frames, mode);
+        simulator.packTextures(heightMaps + frame * frameSize, normalMaps + frame * frameSize);
+    }
+}
+
+OceanFrameCache::~OceanFrameCache()
+{
+    freeAligned(heightMaps);
+    freeAligned(normalMaps);
+}
+
+void OceanFrameCache::sample(float time, float *heightMap, float *normalMap, ThreadPool *pool) const
+{
+    // Position in frames, wrapped in double so large times keep the fraction
+    double position = std::fmod((double)time / loopPeriod, 1.0) * frames;
+    if (position < 0.0)
+        position += frames;
+    int frame = (int)position % frames;
+    int next = (frame + 1) % frames;
+    float weight = (float)(position - std::floor(position));
+    const float *height0 = heightMaps + frame * frameSize, *height1 = heightMaps + next * frameSize;
+    const float *normal0 = normalMaps + frame * frameSize, *normal1 = normalMaps + next * frameSize;
+
+    auto blend = [&](int rowBegin, int rowEnd) {
+        for (size_t i = 3 * (size_t)rowBegin * N; i < 3 * (size_t)rowEnd * N; ++i) {
+            heightMap[i] = height0[i] + weight * (height1[i] - height0[i]);
+            normalMap[i] = normal0[i] + weight * (normal1[i] - normal0[i]);
+        }
+    };
+    if (pool)
+        pool->parallelFor(N, blend);
+    else
+        blend(0, N);
+}
@@ -0,0 +1,52 @@
+//
+// Precomputed frames of a looping ocean
+//
+// An ocean with a loop period repeats exactly, so a fixed number of frames
+// over one period is all it ever shows. The cache simulates and packs them
+// once, after which a frame only costs the interpolation between the two
+// nearest ones instead of a spectrum evaluation and five 2D transforms.
+//
+
+#ifndef PROJECT_OCEAN_FRAME_CACHE_H
+#define PROJECT_OCEAN_FRAME_CACHE_H
+
+#include "OceanSimulator.h"
+
+class OceanFrameCache
+{
+public:
+    // Simulates frames evenly spaced over the loop period of simulator,
+    // which must be set, and keeps them packed as the height and normal
+    // maps of OceanSimulator::packTextures. Throws std::invalid_argument if
+    // frames is less than 1 or the loop period is not positive.
+    OceanFrameCache(OceanSimulator &simulator, int frames, FFTMode mode = FFTMode::Real);
+    ~OceanFrameCache();
+
+    OceanFrameCache(const OceanFrameCache &) = delete;
+    OceanFrameCache &operator=(const OceanFrameCache &) = delete;
+
+    int frameCount() const { return frames; }
+
+    float period() const { return loopPeriod; }
+
+    // Writes the maps at time, wrapped into the period, as the linear
+    // interpolation of the frames before and after it. Both maps hold 3*N*N
+    // floats. With a pool the rows are split across its threads.
+    void sample(float time, float *heightMap, float *normalMap, ThreadPool *pool = nullptr) const;
+
+    // Bytes the frames take
+    size_t memorySize() const { return 2 * (size_t)frames * frameSize * sizeof(float); }
+
+private:
+    int N;
+    int frames;
+    float loopPeriod;
+    // Floats of one map
+    size_t frameSize;
+    // The maps of every frame, one after the other
+    float *heightMaps;
+    float *normalMaps;
+};
+
+
+#endif //PROJECT_OCEAN_FRAME_CACHE_H
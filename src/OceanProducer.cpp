@@ -0,0 +1,103 @@
+//
+// The ocean simulation on a thread of its own
+//
+
+#include "OceanProducer.h"
+
+OceanProducer::OceanProducer(OceanSimulator &simulator, OceanQuery *query)
+        : simulator(simulator), query(query), frames(), pending(false), stopping(false), requestTime(0.0f),
+          requestMode(FFTMode::Real),
+          requestHeight(heightMapFormat(MapEncoding::RGB32F)), requestNormal(normalMapFormat(MapEncoding::RGB32F)),
+          requested(0), published(0)
+{
+    // Three floats per texel is the largest encoding
+    size_t bytes = 3 * sizeof(float) * simulator.size() * simulator.size();
+    for (int i = 0; i < 3; ++i) {
+        heightMaps[i] = allocateAligned(bytes);
+        normalMaps[i] = allocateAligned(bytes);
+    }
+    producer = std::thread(&OceanProducer::producerLoop, this);
+}
+
+OceanProducer::~OceanProducer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    producer.join();
+    for (int i = 0; i < 3; ++i) {
+        freeAligned(heightMaps[i]);
+        freeAligned(normalMaps[i]);
+    }
+}
+
+void OceanProducer::request(float time, FFTMode mode, const MapFormat &heightFormat,
+                            const MapFormat &normalFormat)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requestTime = time;
+        requestMode = mode;
+        requestHeight = heightFormat;
+        requestNormal = normalFormat;
+        requestStart = std::chrono::steady_clock::now();
+        pending = true;
+        ++requested;
+    }
+    changed.notify_all();
+}
+
+const OceanFrame *OceanProducer::latest()
+{
+    if (!slots.acquire())
+        return nullptr;
+    return &frames[slots.readSlot()];
+}
+
+void OceanProducer::waitForRequest()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return published >= requested; });
+}
+
+void OceanProducer::producerLoop()
+{
+    using Clock = std::chrono::steady_clock;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        changed.wait(lock, [this] { return pending || stopping; });
+        if (stopping)
+            return;
+        float time = requestTime;
+        FFTMode mode = requestMode;
+        MapFormat heightFormat = requestHeight, normalFormat = requestNormal;
+        Clock::time_point start = requestStart;
+        long long number = requested;
+        pending = false;
+        lock.unlock();
+
+        auto simulateStart = Clock::now();
+        int slot = slots.writeSlot();
+        OceanFrame &frame = frames[slot];
+        simulator.simulate(time, mode);
+        frame.stats = simulator.packTextures(heightFormat, heightMaps[slot], normalFormat, normalMaps[slot]);
+        auto end = Clock::now();
+        frame.time = time;
+        frame.heightMap = heightMaps[slot];
+        frame.normalMap = normalMaps[slot];
+        frame.heightFormat = heightFormat;
+        frame.normalFormat = normalFormat;
+        frame.simulateTime = std::chrono::duration<double, std::milli>(end - simulateStart).count();
+        frame.latency = std::chrono::duration<double>(end - start).count();
+        slots.publish();
+        // After the maps, which the renderer waits for
+        if (query)
+            query->publish(simulator, time);
+
+        lock.lock();
+        published = number;
+        changed.notify_all();
+    }
+}
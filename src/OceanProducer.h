@@ -0,0 +1,120 @@
+//
+// The ocean simulation on a thread of its own
+//
+// A renderer that simulates before it draws adds the whole simulation to
+// the latency of every frame. OceanProducer instead simulates and packs
+// the maps of the time the renderer asks for next on a producer thread,
+// and hands finished frames over through a TripleBuffer, so taking the
+// latest one never waits and the renderer only pays for its upload.
+//
+
+#ifndef PROJECT_OCEAN_PRODUCER_H
+#define PROJECT_OCEAN_PRODUCER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "OceanQuery.h"
+#include "OceanSimulator.h"
+#include "TripleBuffer.h"
+
+// Mean, jitter and worst case of a series of durations
+struct TimingStats
+{
+    long long count = 0;
+    double total = 0.0;
+    double squares = 0.0;
+    double worst = 0.0;
+
+    void add(double value)
+    {
+        ++count;
+        total += value;
+        squares += value * value;
+        worst = std::max(worst, value);
+    }
+
+    double mean() const { return count ? total / count : 0.0; }
+
+    // Standard deviation
+    double jitter() const
+    {
+        return count ? std::sqrt(std::max(0.0, squares / count - mean() * mean())) : 0.0;
+    }
+};
+
+// A frame the producer finished
+struct OceanFrame
+{
+    // Time it was simulated for
+    float time;
+    // The packed maps, in the formats requested with the time
+    const void *heightMap;
+    const void *normalMap;
+    MapFormat heightFormat, normalFormat;
+    OceanMapStats stats;
+    // Milliseconds the producer spent simulating and packing it
+    double simulateTime;
+    // Seconds between the request and the end of packing
+    double latency;
+};
+
+class OceanProducer
+{
+public:
+    // Starts the producer thread, which then has simulator to itself until
+    // the producer is destroyed. Nothing else may use the simulator or its
+    // thread pool meanwhile. Every frame is also published to query, if
+    // there is one.
+    explicit OceanProducer(OceanSimulator &simulator, OceanQuery *query = nullptr);
+    // Waits for the frame being simulated, if any, and stops the thread
+    ~OceanProducer();
+
+    OceanProducer(const OceanProducer &) = delete;
+    OceanProducer &operator=(const OceanProducer &) = delete;
+
+    // Asks for the maps at time, transformed in mode and packed in the given
+    // formats. Returns at once; a request the producer has not started yet
+    // is replaced.
+    void request(float time, FFTMode mode, const MapFormat &heightFormat, const MapFormat &normalFormat);
+
+    // The frame finished last, or nullptr if there is none newer than the
+    // one of the last call. The frame stays valid until the next call.
+    // Never waits for the producer.
+    const OceanFrame *latest();
+
+    // Blocks until the frame of the last request is published, for tests
+    // and tools that need a particular frame
+    void waitForRequest();
+
+private:
+    OceanSimulator &simulator;
+    OceanQuery *query;
+    // The maps of every slot, each big enough for any encoding
+    void *heightMaps[3];
+    void *normalMaps[3];
+    OceanFrame frames[3];
+    TripleBuffer slots;
+
+    // Guards the request, which only the producer waits for
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool pending;
+    bool stopping;
+    float requestTime;
+    FFTMode requestMode;
+    MapFormat requestHeight, requestNormal;
+    std::chrono::steady_clock::time_point requestStart;
+    // Number of requests made and published, for waitForRequest
+    long long requested, published;
+    std::thread producer;
+
+    void producerLoop();
+};
+
+
+#endif //PROJECT_OCEAN_PRODUCER_H
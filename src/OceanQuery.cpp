@@ -0,0 +1,391 @@
+//
+// The ocean surface at arbitrary points
+//
+
+#include "OceanQuery.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Points sample traces through a frame at a time
+const int QueryChunk = 64;
+
+// A frame at a run of points: the grid position traced back to and the
+// fields there
+struct SurfacePlanes
+{
+    float *u, *v;
+    float *height, *dispX, *dispZ, *slopeX, *slopeZ;
+};
+
+// The cell of the periodic grid p falls in along one axis, and how far
+// into it
+inline void gridCell(float p, float scale, float inverseSize, int size, int &i0, int &i1, float &f)
+{
+    float g = p * scale;
+    g -= size * std::floor(g * inverseSize);
+    float cell = std::floor(g);
+    f = g - cell;
+    // Rounding can leave g a hair outside [0, size)
+    i0 = (int)cell;
+    i0 = i0 < 0 ? i0 + size : i0 >= size ? i0 - size : i0;
+    i1 = i0 + 1 == size ? 0 : i0 + 1;
+}
+
+inline float lerp(float a, float b, float f)
+{
+    return a + f * (b - a);
+}
+
+// Determinant below which the surface is taken to fold over, where the
+// inversion falls back to plain fixed point steps
+const float FoldDeterminant = 0.1f;
+
+// The step of one Newton iteration of u - d(u) = p, given the residual r
+// and the derivatives of d = (dx, dz) along u and v
+inline void newtonStep(float r0, float r1, float dxdu, float dxdv, float dzdu, float dzdv, float &du, float &dv)
+{
+    float j00 = 1.0f - dxdu, j01 = -dxdv, j10 = -dzdu, j11 = 1.0f - dzdv;
+    float determinant = j00 * j11 - j01 * j10;
+    if (determinant > FoldDeterminant) {
+        du = (j11 * r0 - j01 * r1) / determinant;
+        dv = (j00 * r1 - j10 * r0) / determinant;
+    } else {
+        du = r0, dv = r1;
+    }
+}
+
+// Traces the points [first, count) of (x, z) back through the horizontal
+// displacement of frame, then samples its fields there
+void traceScalar(const OceanSnapshot &frame, const float *x, const float *z, int first, int count,
+                 int iterations, const SurfacePlanes &out)
+{
+    int n = frame.size;
+    float scale = n / frame.length, inverseSize = 1.0f / n, cellSize = frame.length / n;
+    for (int j = first; j < count; ++j) {
+        float u = x[j], v = z[j];
+        int i0, i1, k0, k1;
+        float fx, fz;
+        for (int pass = 0; pass <= iterations; ++pass) {
+            gridCell(u, scale, inverseSize, n, i0, i1, fx);
+            gridCell(v, scale, inverseSize, n, k0, k1, fz);
+            const int stride = OceanSnapshot::TexelFloats;
+            int c00 = (i0 * n + k0) * stride, c01 = (i0 * n + k1) * stride;
+            int c10 = (i1 * n + k0) * stride, c11 = (i1 * n + k1) * stride;
+            auto sample = [&](OceanSnapshot::Field field) {
+                const float *f = frame.texels.data() + field;
+                return lerp(lerp(f[c00], f[c01], fz), lerp(f[c10], f[c11], fz), fx);
+            };
+            const float *fieldX = frame.texels.data() + OceanSnapshot::DispX;
+            const float *fieldZ = frame.texels.data() + OceanSnapshot::DispZ;
+            float dispX = sample(OceanSnapshot::DispX), dispZ = sample(OceanSnapshot::DispZ);
+            if (pass < iterations) {
+                // The grid position whose displaced position is (x, z)
+                // satisfies u - dispX(u, v) = x and v - dispZ(u, v) = z
+                float dxdu = lerp(fieldX[c10] - fieldX[c00], fieldX[c11] - fieldX[c01], fz) * scale;
+                float dxdv = lerp(fieldX[c01] - fieldX[c00], fieldX[c11] - fieldX[c10], fx) * scale;
+                float dzdu = lerp(fieldZ[c10] - fieldZ[c00], fieldZ[c11] - fieldZ[c01], fz) * scale;
+                float dzdv = lerp(fieldZ[c01] - fieldZ[c00], fieldZ[c11] - fieldZ[c10], fx) * scale;
+                float du, dv;
+                newtonStep(x[j] - (u - dispX), z[j] - (v - dispZ), dxdu, dxdv, dzdu, dzdv, du, dv);
+                // Steps are kept within a cell, where the bilinear
+                // derivatives hold
+                u += std::min(std::max(du, -cellSize), cellSize);
+                v += std::min(std::max(dv, -cellSize), cellSize);
+                continue;
+            }
+            out.u[j] = u;
+            out.v[j] = v;
+            out.dispX[j] = dispX;
+            out.dispZ[j] = dispZ;
+            out.height[j] = sample(OceanSnapshot::Height);
+            out.slopeX[j] = sample(OceanSnapshot::SlopeX);
+            out.slopeZ[j] = sample(OceanSnapshot::SlopeZ);
+        }
+    }
+}
+
+#ifdef OCEAN_SIMD_X86
+
+// Same as gridCell, eight points at a time
+OCEAN_TARGET_AVX2 inline void gridCellAVX2(__m256 p, __m256 scale, __m256 inverseSize, __m256 sizeFloat,
+                                           __m256i size, __m256i &i0, __m256i &i1, __m256 &f)
+{
+    const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi32(1);
+    __m256 g = _mm256_mul_ps(p, scale);
+    g = _mm256_fnmadd_ps(sizeFloat, _mm256_floor_ps(_mm256_mul_ps(g, inverseSize)), g);
+    __m256 cell = _mm256_floor_ps(g);
+    f = _mm256_sub_ps(g, cell);
+    __m256i i = _mm256_cvttps_epi32(cell);
+    i = _mm256_add_epi32(i, _mm256_and_si256(_mm256_cmpgt_epi32(zero, i), size));
+    i = _mm256_sub_epi32(i, _mm256_and_si256(_mm256_cmpgt_epi32(i, _mm256_sub_epi32(size, one)), size));
+    i0 = i;
+    __m256i next = _mm256_add_epi32(i, one);
+    i1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(next, size), next);
+}
+
+OCEAN_TARGET_AVX2 inline __m256 lerpAVX2(__m256 a, __m256 b, __m256 f)
+{
+    return _mm256_fmadd_ps(f, _mm256_sub_ps(b, a), a);
+}
+
+// The four corners of the cells of eight points
+struct CornersAVX2
+{
+    __m256i c00, c01, c10, c11;
+    __m256 fx, fz;
+};
+
+OCEAN_TARGET_AVX2 inline __m256 sampleAVX2(const float *field, const CornersAVX2 &c)
+{
+    __m256 g00 = _mm256_i32gather_ps(field, c.c00, 4), g01 = _mm256_i32gather_ps(field, c.c01, 4);
+    __m256 g10 = _mm256_i32gather_ps(field, c.c10, 4), g11 = _mm256_i32gather_ps(field, c.c11, 4);
+    return lerpAVX2(lerpAVX2(g00, g01, c.fz), lerpAVX2(g10, g11, c.fz), c.fx);
+}
+
+// Same as sampleAVX2, along with the derivatives along u and v in cells
+OCEAN_TARGET_AVX2 inline __m256 sampleAVX2(const float *field, const CornersAVX2 &c, __m256 &du, __m256 &dv)
+{
+    __m256 g00 = _mm256_i32gather_ps(field, c.c00, 4), g01 = _mm256_i32gather_ps(field, c.c01, 4);
+    __m256 g10 = _mm256_i32gather_ps(field, c.c10, 4), g11 = _mm256_i32gather_ps(field, c.c11, 4);
+    du = lerpAVX2(_mm256_sub_ps(g10, g00), _mm256_sub_ps(g11, g01), c.fz);
+    dv = lerpAVX2(_mm256_sub_ps(g01, g00), _mm256_sub_ps(g11, g10), c.fx);
+    return lerpAVX2(lerpAVX2(g00, g01, c.fz), lerpAVX2(g10, g11, c.fz), c.fx);
+}
+
+// Same as traceScalar, eight points at a time
+OCEAN_TARGET_AVX2 void traceAVX2(const OceanSnapshot &frame, const float *x, const float *z, int count,
+                                 int iterations, const SurfacePlanes &out)
+{
+    int n = frame.size;
+    const __m256 scale = _mm256_set1_ps(n / frame.length), inverseSize = _mm256_set1_ps(1.0f / n);
+    const __m256 sizeFloat = _mm256_set1_ps((float)n);
+    const __m256i size = _mm256_set1_epi32(n);
+    static_assert(OceanSnapshot::TexelFloats == 8, "traceAVX2 shifts texel indices by 3");
+    const float *texels = frame.texels.data();
+    const __m256 one = _mm256_set1_ps(1.0f), negativeScale = _mm256_set1_ps(-(n / frame.length));
+    const __m256 fold = _mm256_set1_ps(FoldDeterminant);
+    const __m256 cell = _mm256_set1_ps(frame.length / n), negativeCell = _mm256_set1_ps(-(frame.length / n));
+    int j = 0;
+    for (; j + 8 <= count; j += 8) {
+        __m256 px = _mm256_loadu_ps(x + j), pz = _mm256_loadu_ps(z + j);
+        __m256 u = px, v = pz;
+        for (int pass = 0;; ++pass) {
+            __m256i i0, i1, k0, k1;
+            CornersAVX2 c;
+            gridCellAVX2(u, scale, inverseSize, sizeFloat, size, i0, i1, c.fx);
+            gridCellAVX2(v, scale, inverseSize, sizeFloat, size, k0, k1, c.fz);
+            __m256i row0 = _mm256_mullo_epi32(i0, size), row1 = _mm256_mullo_epi32(i1, size);
+            // Eight floats per texel
+            c.c00 = _mm256_slli_epi32(_mm256_add_epi32(row0, k0), 3);
+            c.c01 = _mm256_slli_epi32(_mm256_add_epi32(row0, k1), 3);
+            c.c10 = _mm256_slli_epi32(_mm256_add_epi32(row1, k0), 3);
+            c.c11 = _mm256_slli_epi32(_mm256_add_epi32(row1, k1), 3);
+            if (pass < iterations) {
+                __m256 dxdu, dxdv, dzdu, dzdv;
+                __m256 dispX = sampleAVX2(texels + OceanSnapshot::DispX, c, dxdu, dxdv);
+                __m256 dispZ = sampleAVX2(texels + OceanSnapshot::DispZ, c, dzdu, dzdv);
+                __m256 r0 = _mm256_sub_ps(px, _mm256_sub_ps(u, dispX));
+                __m256 r1 = _mm256_sub_ps(pz, _mm256_sub_ps(v, dispZ));
+                __m256 j00 = _mm256_fnmadd_ps(dxdu, scale, one), j01 = _mm256_mul_ps(dxdv, negativeScale);
+                __m256 j10 = _mm256_mul_ps(dzdu, negativeScale), j11 = _mm256_fnmadd_ps(dzdv, scale, one);
+                __m256 determinant = _mm256_fmsub_ps(j00, j11, _mm256_mul_ps(j01, j10));
+                __m256 newton = _mm256_cmp_ps(determinant, fold, _CMP_GT_OQ);
+                // The division is masked off where it falls back
+                __m256 inverse = _mm256_div_ps(one, _mm256_blendv_ps(one, determinant, newton));
+                __m256 du = _mm256_mul_ps(_mm256_fmsub_ps(j11, r0, _mm256_mul_ps(j01, r1)), inverse);
+                __m256 dv = _mm256_mul_ps(_mm256_fmsub_ps(j00, r1, _mm256_mul_ps(j10, r0)), inverse);
+                du = _mm256_blendv_ps(r0, du, newton);
+                dv = _mm256_blendv_ps(r1, dv, newton);
+                u = _mm256_add_ps(u, _mm256_min_ps(_mm256_max_ps(du, negativeCell), cell));
+                v = _mm256_add_ps(v, _mm256_min_ps(_mm256_max_ps(dv, negativeCell), cell));
+                continue;
+            }
+            __m256 dispX = sampleAVX2(texels + OceanSnapshot::DispX, c), dispZ = sampleAVX2(texels + OceanSnapshot::DispZ, c);
+            _mm256_storeu_ps(out.u + j, u);
+            _mm256_storeu_ps(out.v + j, v);
+            _mm256_storeu_ps(out.dispX + j, dispX);
+            _mm256_storeu_ps(out.dispZ + j, dispZ);
+            _mm256_storeu_ps(out.height + j, sampleAVX2(texels + OceanSnapshot::Height, c));
+            _mm256_storeu_ps(out.slopeX + j, sampleAVX2(texels + OceanSnapshot::SlopeX, c));
+            _mm256_storeu_ps(out.slopeZ + j, sampleAVX2(texels + OceanSnapshot::SlopeZ, c));
+            break;
+        }
+    }
+    traceScalar(frame, x, z, j, count, iterations, out);
+}
+
+#endif
+
+void trace(const OceanSnapshot &frame, const float *x, const float *z, int count, int iterations,
+           const SurfacePlanes &out, InstructionSet isa)
+{
+#ifdef OCEAN_SIMD_X86
+    if (resolveInstructionSet(isa) == InstructionSet::AVX2) {
+        traceAVX2(frame, x, z, count, iterations, out);
+        return;
+    }
+#endif
+    traceScalar(frame, x, z, 0, count, iterations, out);
+}
+
+// Stack planes for one chunk of a frame
+struct ChunkPlanes
+{
+    alignas(SIMDAlignment) float u[QueryChunk], v[QueryChunk];
+    alignas(SIMDAlignment) float height[QueryChunk], dispX[QueryChunk], dispZ[QueryChunk];
+    alignas(SIMDAlignment) float slopeX[QueryChunk], slopeZ[QueryChunk];
+
+    SurfacePlanes planes() { return {u, v, height, dispX, dispZ, slopeX, slopeZ}; }
+};
+
+// Copies count values to out + first, unless out is null
+void store(float *out, int first, const float *values, int count)
+{
+    if (out)
+        std::memcpy(out + first, values, count * sizeof(float));
+}
+
+}
+
+OceanQuery::OceanQuery(InstructionSet isa)
+        : isa(isa), inversionIterations(4)
+{
+}
+
+void OceanQuery::publish(const OceanSimulator &simulator, float time)
+{
+    std::shared_ptr<OceanSnapshot> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        snapshot = std::move(spare);
+    }
+    if (!snapshot)
+        snapshot = std::make_shared<OceanSnapshot>();
+
+    int n = simulator.size();
+    snapshot->time = time;
+    snapshot->size = n;
+    snapshot->length = (float)simulator.length();
+    snapshot->texels.resize((size_t)n * n * OceanSnapshot::TexelFloats);
+    OceanFields f = simulator.fields();
+    simulator.threadPool()->parallelFor(n, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; ++i) {
+            for (int j = 0; j < n; ++j) {
+                int index = i * f.rowStride + j * f.step;
+                float *texel = snapshot->texels.data() + (size_t)(i * n + j) * OceanSnapshot::TexelFloats;
+                texel[OceanSnapshot::DispX] = f.dispX[index];
+                texel[OceanSnapshot::DispZ] = f.dispZ[index];
+                texel[OceanSnapshot::Height] = f.height[index];
+                texel[OceanSnapshot::SlopeX] = f.slopeX[index];
+                texel[OceanSnapshot::SlopeZ] = f.slopeZ[index];
+            }
+        }
+    });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto &newest = frames[FrameCount - 1];
+    if (newest && time <= newest->time) {
+        for (auto &frame : frames)
+            frame.reset();
+    }
+    // Queries only copy frames under the lock, so one nobody holds now
+    // stays unused once it is dropped
+    if (frames[0] && frames[0].use_count() == 1)
+        spare = std::const_pointer_cast<OceanSnapshot>(frames[0]);
+    for (int i = 0; i + 1 < FrameCount; ++i)
+        frames[i] = std::move(frames[i + 1]);
+    frames[FrameCount - 1] = std::move(snapshot);
+}
+
+void OceanQuery::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &frame : frames)
+        frame.reset();
+}
+
+bool OceanQuery::ready() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames[FrameCount - 1] != nullptr;
+}
+
+void OceanQuery::sample(const float *x, const float *z, int count, float time,
+                        const OceanSurfaceSamples &out) const
+{
+    std::shared_ptr<const OceanSnapshot> kept[FrameCount];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::copy(frames, frames + FrameCount, kept);
+    }
+    int first = 0;
+    while (first < FrameCount && !kept[first])
+        ++first;
+
+    // The frames before and after time, or the nearest two
+    const OceanSnapshot *from = nullptr, *to = nullptr;
+    if (first < FrameCount) {
+        int k = first;
+        while (k + 2 < FrameCount && kept[k + 1]->time <= time)
+            ++k;
+        to = kept[std::min(k + 1, FrameCount - 1)].get();
+        if (k + 1 < FrameCount)
+            from = kept[k].get();
+    }
+    float blend = 1.0f, inverseStep = 0.0f;
+    if (from) {
+        blend = std::min(std::max((time - from->time) / (to->time - from->time), 0.0f), 1.0f);
+        inverseStep = 1.0f / (to->time - from->time);
+    }
+
+    ChunkPlanes next, previous, origin;
+    alignas(SIMDAlignment) float values[7][QueryChunk];
+    for (int begin = 0; begin < count; begin += QueryChunk) {
+        int n = std::min(QueryChunk, count - begin);
+        if (!to) {
+            // A flat, still sea
+            for (auto &plane : values)
+                std::fill(plane, plane + n, 0.0f);
+            std::fill(values[2], values[2] + n, 1.0f);
+        } else {
+            SurfacePlanes a = next.planes(), b = previous.planes(), c = origin.planes();
+            trace(*to, x + begin, z + begin, n, inversionIterations, a, isa);
+            if (from) {
+                trace(*from, x + begin, z + begin, n, inversionIterations, b, isa);
+                // The earlier frame at the same grid position, which is the
+                // same water, for its velocity
+                trace(*from, a.u, a.v, n, 0, c, isa);
+            }
+            for (int j = 0; j < n; ++j) {
+                float height = a.height[j], slopeX = a.slopeX[j], slopeZ = a.slopeZ[j];
+                float velocityX = 0.0f, velocityY = 0.0f, velocityZ = 0.0f;
+                if (from) {
+                    // Exactly one frame at either end of the blend
+                    height = (1.0f - blend) * b.height[j] + blend * height;
+                    slopeX = (1.0f - blend) * b.slopeX[j] + blend * slopeX;
+                    slopeZ = (1.0f - blend) * b.slopeZ[j] + blend * slopeZ;
+                    // Displaced positions are (u - dispX, height, v - dispZ)
+                    velocityX = (c.dispX[j] - a.dispX[j]) * inverseStep;
+                    velocityY = (a.height[j] - c.height[j]) * inverseStep;
+                    velocityZ = (c.dispZ[j] - a.dispZ[j]) * inverseStep;
+                }
+                float length = 1.0f / std::sqrt(slopeX * slopeX + 1.0f + slopeZ * slopeZ);
+                values[0][j] = height;
+                values[1][j] = -slopeX * length, values[2][j] = length, values[3][j] = -slopeZ * length;
+                values[4][j] = velocityX, values[5][j] = velocityY, values[6][j] = velocityZ;
+            }
+        }
+        store(out.height, begin, values[0], n);
+        store(out.normalX, begin, values[1], n);
+        store(out.normalY, begin, values[2], n);
+        store(out.normalZ, begin, values[3], n);
+        store(out.velocityX, begin, values[4], n);
+        store(out.velocityY, begin, values[5], n);
+        store(out.velocityZ, begin, values[6], n);
+    }
+}
@@ -0,0 +1,102 @@
+//
+// The ocean surface at arbitrary points, for buoyancy and gameplay
+//
+// The simulated fields only exist on the grid, and the choppy waves move
+// every grid point sideways before it is drawn. OceanQuery keeps copies of
+// the last frames a simulator produced and answers batches of world points
+// from them: every point is traced back to the grid position whose
+// displaced position lands on it, where the fields are sampled bilinearly
+// from the periodic grid. Frames may be published while other threads
+// query.
+//
+
+#ifndef PROJECT_OCEAN_QUERY_H
+#define PROJECT_OCEAN_QUERY_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "OceanSimulator.h"
+
+// Where OceanQuery::sample writes the surface at its points, one float per
+// point in each. Null pointers skip that output.
+struct OceanSurfaceSamples
+{
+    float *height = nullptr;
+    // Unit normal
+    float *normalX = nullptr, *normalY = nullptr, *normalZ = nullptr;
+    // Velocity of the water at the surface, in units per second of the
+    // time the frames were published with
+    float *velocityX = nullptr, *velocityY = nullptr, *velocityZ = nullptr;
+};
+
+// The fields of one simulated frame. Every texel keeps its fields
+// together, so a bilinear sample touches two cache lines or so instead of
+// one or two per field.
+struct OceanSnapshot
+{
+    enum Field { DispX, DispZ, Height, SlopeX, SlopeZ };
+    // Floats per texel, padded to a power of two so texels stay within
+    // cache lines
+    static const int TexelFloats = 8;
+
+    float time;
+    int size;
+    float length;
+    // Field f of grid point (i, j) is texels[(i * size + j) * TexelFloats + f]
+    std::vector<float, AlignedAllocator<float>> texels;
+};
+
+class OceanQuery
+{
+public:
+    // isa selects the sampling kernels, Auto picks the widest the CPU has
+    explicit OceanQuery(InstructionSet isa = InstructionSet::Auto);
+
+    // Copies the fields of the last simulate of simulator as the frame of
+    // time. Call it from the thread that simulates, before it simulates
+    // again. A time before that of the frames kept starts over from this
+    // frame.
+    void publish(const OceanSimulator &simulator, float time);
+
+    // Forgets every frame, as when the simulation changes
+    void clear();
+
+    // Whether there is a frame to sample
+    bool ready() const;
+
+    // Samples the surface at the count world points (x[i], z[i]), given in
+    // the units of OceanSimulator::length and periodic with it. Between two
+    // frames, heights and normals are blended like the maps of
+    // Ocean::setSimulationRate; outside them, the nearest frame is used.
+    // Velocities come from the two frames around time, and are 0 while
+    // there is only one. Without any frame the sea is flat and still. Safe
+    // to call from any number of threads, also during publish.
+    void sample(const float *x, const float *z, int count, float time, const OceanSurfaceSamples &out) const;
+
+    // Newton iterations that trace points back through the horizontal
+    // displacement, 4 by default, which reach float precision on waves
+    // that do not fold over. Where they do, the surface has no single
+    // height and the result is one of them or in between. 0 ignores
+    // displacement. Set it before other threads sample.
+    void setInversionIterations(int iterations) { inversionIterations = iterations; }
+
+private:
+    // Frames kept, enough for the two around the render time and one that
+    // was simulated ahead of it
+    static const int FrameCount = 3;
+
+    InstructionSet isa;
+    int inversionIterations;
+    // Guards the frames, which are only read through copies of the
+    // pointers, so sampling never holds it for long
+    mutable std::mutex mutex;
+    // By time, oldest first. Null where there is none yet.
+    std::shared_ptr<const OceanSnapshot> frames[FrameCount];
+    // A dropped frame no query held, which publish refills
+    std::shared_ptr<OceanSnapshot> spare;
+};
+
+
+#endif //PROJECT_OCEAN_QUERY_H
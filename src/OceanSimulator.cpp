@@ -0,0 +1,504 @@
+//
+// The ocean simulation without any rendering
+//
+
+#include "OceanSimulator.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// The spectrum is evaluated at (time + TimeOffset) * timeScale. The offset
+// eliminates the initial status when time accumulates from 0.
+static const float TimeOffset = 10000.0f;
+// Steps the phase rotors are advanced by before they are evaluated directly
+// again, which bounds the rounding error the rotations accumulate
+static const int PhaseResyncInterval = 64;
+static const double TwoPI = 6.28318530717958647692;
+// Texels packTextures computes before it encodes them
+static const int PackChunk = 64;
+
+OceanSimulator::OceanSimulator(glm::vec2 wind, int resolution, float amplitude, float timeScale)
+        : timeScale(timeScale), N(resolution), A(amplitude), w(wind), fft(resolution), rfft(resolution),
+          pool(new ThreadPool()),
+          seed((unsigned)std::chrono::high_resolution_clock::now().time_since_epoch().count())
+{
+    g  = 9.8f;
+    PI = 3.1415926f;
+    L  =  N / 8;
+    hBuffer            = allocateAlignedArray<std::complex<float>>(N * N);
+    kBuffer            = new glm::vec2[N * N];
+    epsilonBufferx     = allocateAlignedArray<std::complex<float>>(N * N);
+    epsilonBuffery     = allocateAlignedArray<std::complex<float>>(N * N);
+    displacementBufferx = allocateAlignedArray<std::complex<float>>(N * N);
+    displacementBuffery = allocateAlignedArray<std::complex<float>>(N * N);
+    scratchBuffer      = allocateAlignedArray<std::complex<float>>(rfft.scratchSize());
+    h0Real             = allocateAlignedArray<float>(N * rfft.halfSize());
+    h0Imag             = allocateAlignedArray<float>(N * rfft.halfSize());
+    h0ConjReal         = allocateAlignedArray<float>(N * rfft.halfSize());
+    h0ConjImag         = allocateAlignedArray<float>(N * rfft.halfSize());
+    omegaTable         = allocateAlignedArray<float>(N * rfft.halfSize());
+    phaseReal          = allocateAlignedArray<float>(N * rfft.halfSize());
+    phaseImag          = allocateAlignedArray<float>(N * rfft.halfSize());
+    stepReal           = allocateAlignedArray<float>(N * rfft.halfSize());
+    stepImag           = allocateAlignedArray<float>(N * rfft.halfSize());
+    kxTable            = allocateAlignedArray<float>(N * rfft.halfSize());
+    kzTable            = allocateAlignedArray<float>(N * rfft.halfSize());
+    kxOverK            = allocateAlignedArray<float>(N * rfft.halfSize());
+    kzOverK            = allocateAlignedArray<float>(N * rfft.halfSize());
+    timeStep = 0.0f;
+    repeatPeriod = 0.0f;
+    phaseTime = 0.0f;
+    stepsSinceSync = -1;
+    lastMode = FFTMode::Real;
+    lastTimings = OceanTimings();
+    reserveScratch(N, pool.get());
+
+    // Compute k buffer. It is stored in the order the FFT takes it, with
+    // k = 0 first and negative n and m wrapped to the end, so the result
+    // needs no shift.
+    for (int n = -N / 2; n < N / 2; ++n) {
+        float kx = 2.0f * PI * n / L;
+        for (int m = -N / 2; m < N / 2; ++m) {
+            glm::vec2 k = glm::vec2(kx, 2.0f * PI * m / L);
+            int bufferIndex = (n + N) % N * N + (m + N) % N;
+            kBuffer[bufferIndex] = k;
+        }
+    }
+    for (int row = 0; row < N; ++row) {
+        for (int col = 0; col < rfft.halfSize(); ++col) {
+            int index = row * rfft.halfSize() + col;
+            glm::vec2 k = kBuffer[row * N + col];
+            // The middle row and column hold the Nyquist frequency, whose
+            // sign is ambiguous. Its derivative is taken as zero, which
+            // keeps the slope and displacement spectra Hermitian.
+            kxTable[index] = row == N / 2 ? 0.0f : k.x;
+            kzTable[index] = col == N / 2 ? 0.0f : k.y;
+            float klength = glm::length(k);
+            kxOverK[index] = klength >= 0.00001f ? kxTable[index] / klength : 0.0f;
+            kzOverK[index] = klength >= 0.00001f ? kzTable[index] / klength : 0.0f;
+        }
+    }
+    computeFrequencies();
+    computeInitialSpectrum();
+}
+
+OceanSimulator::~OceanSimulator()
+{
+    freeAligned(hBuffer);
+    delete[] kBuffer;
+    freeAligned(epsilonBufferx);
+    freeAligned(epsilonBuffery);
+    freeAligned(displacementBufferx);
+    freeAligned(displacementBuffery);
+    freeAligned(scratchBuffer);
+    freeAligned(h0Real);
+    freeAligned(h0Imag);
+    freeAligned(h0ConjReal);
+    freeAligned(h0ConjImag);
+    freeAligned(omegaTable);
+    freeAligned(phaseReal);
+    freeAligned(phaseImag);
+    freeAligned(stepReal);
+    freeAligned(stepImag);
+    freeAligned(kxTable);
+    freeAligned(kzTable);
+    freeAligned(kxOverK);
+    freeAligned(kzOverK);
+}
+
+void OceanSimulator::setThreadCount(int threads)
+{
+    pool.reset(new ThreadPool(threads));
+    reserveScratch(N, pool.get());
+}
+
+void OceanSimulator::setParameters(glm::vec2 wind, float amplitude)
+{
+    w = wind;
+    A = amplitude;
+    computeInitialSpectrum();
+}
+
+void OceanSimulator::setSeed(unsigned seed)
+{
+    this->seed = seed;
+    computeInitialSpectrum();
+}
+
+void OceanSimulator::setTimeStep(float step)
+{
+    timeStep = step;
+    for (int i = 0; i < N * rfft.halfSize(); ++i) {
+        double angle = (double)omegaTable[i] * step * timeScale;
+        stepReal[i] = (float)std::cos(angle);
+        stepImag[i] = (float)std::sin(angle);
+    }
+    stepsSinceSync = -1;
+}
+
+void OceanSimulator::setLoopPeriod(float period)
+{
+    repeatPeriod = period;
+    computeFrequencies();
+    // The step rotors follow the new frequencies
+    setTimeStep(timeStep);
+}
+
+void OceanSimulator::computeFrequencies()
+{
+    // The phase of a wave advances by omega * period * timeScale over one
+    // period, a whole number of turns for multiples of the base frequency
+    double base = repeatPeriod > 0.0f ? TwoPI / ((double)repeatPeriod * timeScale) : 0.0;
+    for (int row = 0; row < N; ++row) {
+        for (int col = 0; col < rfft.halfSize(); ++col) {
+            float frequency = omega(kBuffer[row * N + col]);
+            if (base > 0.0)
+                frequency = (float)(std::floor(frequency / base) * base);
+            omegaTable[row * rfft.halfSize() + col] = frequency;
+        }
+    }
+}
+
+void OceanSimulator::computeInitialSpectrum()
+{
+    // Draw h0(k) for every wave vector in a fixed order, so the same seed
+    // always gives the same spectrum
+    std::default_random_engine random(seed);
+    std::vector<std::complex<float>> h0k(N * N);
+    for (int n = -N / 2; n < N / 2; ++n) {
+        for (int m = -N / 2; m < N / 2; ++m) {
+            int bufferIndex = (n + N) % N * N + (m + N) % N;
+            h0k[bufferIndex] = h0(kBuffer[bufferIndex], random);
+        }
+    }
+    // -k is the wave vector of the mirrored index, with the Nyquist row and
+    // column mirroring onto themselves as the FFT is periodic. Reusing its
+    // h0 keeps every spectrum Hermitian, so the heights are real.
+    int columns = rfft.halfSize();
+    for (int row = 0; row < N; ++row) {
+        for (int col = 0; col < columns; ++col) {
+            int index = row * columns + col;
+            int mirror = (N - row) % N * N + (N - col) % N;
+            h0Real[index] = h0k[row * N + col].real();
+            h0Imag[index] = h0k[row * N + col].imag();
+            h0ConjReal[index] = h0k[mirror].real();
+            h0ConjImag[index] = -h0k[mirror].imag();
+        }
+    }
+}
+
+SpectrumTables OceanSimulator::spectrumTables() const
+{
+    SpectrumTables tables;
+    tables.h0Real = h0Real;
+    tables.h0Imag = h0Imag;
+    tables.h0ConjReal = h0ConjReal;
+    tables.h0ConjImag = h0ConjImag;
+    tables.omega = omegaTable;
+    tables.kx = kxTable;
+    tables.kz = kzTable;
+    tables.kxOverK = kxOverK;
+    tables.kzOverK = kzOverK;
+    tables.stepReal = stepReal;
+    tables.stepImag = stepImag;
+    tables.phaseReal = phaseReal;
+    tables.phaseImag = phaseImag;
+    return tables;
+}
+
+void OceanSimulator::updateSpectrum(float time, int stride)
+{
+    // Phases are advanced by rotation if this frame is one time step after
+    // the last one, and evaluated directly otherwise
+    bool advance = timeStep > 0.0f && stepsSinceSync >= 0 && stepsSinceSync < PhaseResyncInterval
+                   && std::abs(time - phaseTime - timeStep) <= 1e-3f * timeStep;
+    // The offset leaves too few bits of time in a float, so the kernel gets
+    // it in double precision
+    double t = ((double)time + TimeOffset) * timeScale;
+    int columns = rfft.halfSize();
+    SpectrumTables tables = spectrumTables();
+    InstructionSet isa = fft.instructionSet();
+    pool->parallelFor(N, [&](int rowBegin, int rowEnd) {
+        for (int row = rowBegin; row < rowEnd; ++row) {
+            int index = row * stride;
+            SpectrumFields fields = {hBuffer + index, epsilonBufferx + index, epsilonBuffery + index,
+                                     displacementBufferx + index, displacementBuffery + index};
+            if (advance)
+                advanceSpectrum(tables, row * columns, columns, fields, isa);
+            else
+                evaluateSpectrum(tables, row * columns, columns, t, fields, isa);
+        }
+    });
+    stepsSinceSync = advance ? stepsSinceSync + 1 : 0;
+    phaseTime = time;
+}
+
+void OceanSimulator::mirrorSpectrum()
+{
+    // The rest of every row is the conjugate of the mirrored point
+    int columns = rfft.halfSize();
+    pool->parallelFor(N, [&](int rowBegin, int rowEnd) {
+        for (int row = rowBegin; row < rowEnd; ++row) {
+            for (int col = columns; col < N; ++col) {
+                int index = row * N + col, mirror = (N - row) % N * N + N - col;
+                hBuffer[index] = std::conj(hBuffer[mirror]);
+                epsilonBufferx[index] = std::conj(epsilonBufferx[mirror]);
+                epsilonBuffery[index] = std::conj(epsilonBuffery[mirror]);
+                displacementBufferx[index] = std::conj(displacementBufferx[mirror]);
+                displacementBuffery[index] = std::conj(displacementBuffery[mirror]);
+            }
+        }
+    });
+}
+
+void OceanSimulator::evaluate(float time)
+{
+    updateSpectrum(time, N);
+    mirrorSpectrum();
+}
+
+void OceanSimulator::simulate(float time, FFTMode mode)
+{
+    using namespace std;
+    using clock = chrono::steady_clock;
+    auto start = clock::now();
+    // Only the first N/2+1 columns of the spectrum are evaluated. Real
+    // transforms take them as they are, the others get the rest of every
+    // row from Hermitian symmetry.
+    bool useReal = mode == FFTMode::Real;
+    bool usePacked = mode == FFTMode::Packed;
+    updateSpectrum(time, useReal ? rfft.halfSize() : N);
+    if (!useReal)
+        mirrorSpectrum();
+    if (usePacked) {
+        // Pack height + i*slopeX and dispX + i*dispZ, slopeZ stays alone
+        pool->parallelFor(N, [&](int rowBegin, int rowEnd) {
+            for (int index = rowBegin * N; index < rowEnd * N; ++index) {
+                complex<float> a = hBuffer[index], b = epsilonBufferx[index];
+                hBuffer[index] = complex<float>(a.real() - b.imag(), a.imag() + b.real());
+                a = displacementBufferx[index];
+                b = displacementBuffery[index];
+                displacementBufferx[index] = complex<float>(a.real() - b.imag(), a.imag() + b.real());
+            }
+        });
+    }
+    auto transformStart = clock::now();
+
+    if (useReal) {
+        rfft.transform2D(hBuffer, pool.get(), scratchBuffer);
+        rfft.transform2D(epsilonBufferx, pool.get(), scratchBuffer);
+        rfft.transform2D(epsilonBuffery, pool.get(), scratchBuffer);
+        rfft.transform2D(displacementBufferx, pool.get(), scratchBuffer);
+        rfft.transform2D(displacementBuffery, pool.get(), scratchBuffer);
+    } else if (usePacked) {
+        fft.transform2D(hBuffer, pool.get());
+        fft.transform2D(epsilonBuffery, pool.get());
+        fft.transform2D(displacementBufferx, pool.get());
+    } else {
+        fft.transform2D(hBuffer, pool.get());
+        fft.transform2D(epsilonBufferx, pool.get());
+        fft.transform2D(epsilonBuffery, pool.get());
+        fft.transform2D(displacementBufferx, pool.get());
+        fft.transform2D(displacementBuffery, pool.get());
+    }
+    lastMode = mode;
+    lastTimings.spectrum = chrono::duration<double, milli>(transformStart - start).count();
+    lastTimings.transform = chrono::duration<double, milli>(clock::now() - transformStart).count();
+}
+
+OceanFields OceanSimulator::fields() const
+{
+    // Only real parts are used. A real transform leaves packed rows of
+    // floats, a complex one leaves the real part in every other float and a
+    // packed one keeps its second field in the imaginary parts.
+    bool useReal = lastMode == FFTMode::Real;
+    OceanFields f;
+    f.rowStride = useReal ? 2 * rfft.halfSize() : 2 * N;
+    f.step = useReal ? 1 : 2;
+    f.height = reinterpret_cast<const float *>(hBuffer);
+    f.slopeX = reinterpret_cast<const float *>(epsilonBufferx);
+    f.slopeZ = reinterpret_cast<const float *>(epsilonBuffery);
+    f.dispX = reinterpret_cast<const float *>(displacementBufferx);
+    f.dispZ = reinterpret_cast<const float *>(displacementBuffery);
+    if (lastMode == FFTMode::Packed) {
+        f.slopeX = f.height + 1;
+        f.dispZ = f.dispX + 1;
+    }
+    return f;
+}
+
+OceanMapStats OceanSimulator::packTextures(float *heightMap, float *normalMap) const
+{
+    return packTextures(heightMapFormat(MapEncoding::RGB32F), heightMap,
+                 normalMapFormat(MapEncoding::RGB32F), normalMap);
+}
+
+OceanMapStats OceanSimulator::packTextures(const MapFormat &heightFormat, void *heightMap,
+                                           const MapFormat &normalFormat, void *normalMap) const
+{
+    if (heightFormat.encoding == MapEncoding::RG16Snorm)
+        throw std::invalid_argument("OceanSimulator: RG16Snorm only stores normals");
+    OceanFields f = fields();
+    InstructionSet isa = fft.instructionSet();
+    size_t heightTexel = mapTexelSize(heightFormat.encoding), normalTexel = mapTexelSize(normalFormat.encoding);
+    TexelRange total;
+    std::mutex totalMutex;
+    pool->parallelFor(N, [&](int rowBegin, int rowEnd) {
+        TexelRange range;
+        // One chunk of each map as planes of channels, which is what the
+        // encoders vectorize over
+        alignas(SIMDAlignment) float hx[PackChunk], hy[PackChunk], hz[PackChunk];
+        alignas(SIMDAlignment) float nx[PackChunk], ny[PackChunk], nz[PackChunk];
+        for (int i = rowBegin; i < rowEnd; ++i) {
+            for (int first = 0; first < N; first += PackChunk) {
+                int count = std::min(PackChunk, N - first);
+                for (int j = 0; j < count; ++j) {
+                    int index = i * f.rowStride + (first + j) * f.step;
+
+                    hx[j] = -f.dispX[index] * heightFormat.scale + heightFormat.bias;
+                    hy[j] =  f.height[index] * heightFormat.scale + heightFormat.bias;
+                    hz[j] = -f.dispZ[index] * heightFormat.scale + heightFormat.bias;
+                    glm::vec3 normal = glm::normalize(glm::vec3(-f.slopeX[index],
+                                                                 1.0f,
+                                                                -f.slopeZ[index]));
+                    nx[j] = normal.x * normalFormat.scale + normalFormat.bias;
+                    ny[j] = normal.y * normalFormat.scale + normalFormat.bias;
+                    nz[j] = normal.z * normalFormat.scale + normalFormat.bias;
+                }
+                measureTexels(hx, hy, hz, count, range, isa);
+                size_t texel = (size_t)i * N + first;
+                encodeTexels(heightFormat.encoding, hx, hy, hz, count,
+                             static_cast<char *>(heightMap) + texel * heightTexel, isa);
+                encodeTexels(normalFormat.encoding, nx, ny, nz, count,
+                             static_cast<char *>(normalMap) + texel * normalTexel, isa);
+            }
+        }
+        std::lock_guard<std::mutex> lock(totalMutex);
+        total.merge(range);
+    });
+
+    OceanMapStats stats;
+    for (int c = 0; c < 3; ++c) {
+        stats.minimum[c] = total.minimum[c] * heightFormat.decodeScale() + heightFormat.decodeBias();
+        stats.maximum[c] = total.maximum[c] * heightFormat.decodeScale() + heightFormat.decodeBias();
+    }
+    stats.clipped = heightFormat.encoding == MapEncoding::RGBA16F ? 0 : total.outside;
+    return stats;
+}
+
+void OceanSimulator::packVertices(float *vertices, float *normals, float width) const
+{
+    OceanFields f = fields();
+    pool->parallelFor(N, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; ++i) {
+            for (int j = 0; j < N; ++j) {
+                int index = i * f.rowStride + j * f.step;
+                int pos = 3 * (i * N + j);
+                float x = width * (i - N / 2.0f) / N,
+                        z = width * (j - N / 2.0f) / N;
+                vertices[pos + 0] = x - f.dispX[index];
+                vertices[pos + 1] = f.height[index];
+                vertices[pos + 2] = z - f.dispZ[index];
+
+                normals[pos + 0] = -f.slopeX[index];
+                normals[pos + 1] = 1;
+                normals[pos + 2] = -f.slopeZ[index];
+            }
+        }
+    });
+}
+
+float OceanSimulator::height(float x, float z) const
+{
+    using std::complex;
+    complex<float> result(0.0f, 0.0f);
+    for (int n = -N / 2; n < N / 2; ++n) {
+        for (int m = -N / 2; m < N / 2; ++m) {
+            int bufferIndex = (n + N) % N * N + (m + N) % N;
+            glm::vec2 k = kBuffer[bufferIndex];
+            float k_dot_x = glm::dot(k, glm::vec2(x, z));
+
+            result += hBuffer[bufferIndex] * complex<float>(cos(k_dot_x), sin(k_dot_x));
+        }
+    }
+    return result.real();
+}
+
+std::complex<float> OceanSimulator::h0(glm::vec2 k, std::default_random_engine &random)
+{
+    using std::complex;
+    float xi1, xi2;
+    normalRandom(random, xi1, xi2);
+    return (1.0f/std::sqrt(2.0f)) * complex<float>(xi1, xi2) * std::sqrt(Ph(k));
+}
+
+void OceanSimulator::normalRandom(std::default_random_engine &random, float &xi1, float &xi2)
+{
+    // The distribution makes its samples in pairs, so both are drawn from one
+    std::normal_distribution<float> dist(0.5, 0.1);
+    xi1 = dist(random);
+    xi2 = dist(random);
+}
+
+float OceanSimulator::Ph(glm::vec2 k)
+{
+    if (glm::length(k) < 0.001f) return 0.0f;
+    float absk = glm::length(k);
+    float L = glm::length(w)*glm::length(w) / g;
+    float result = A;
+    result *= exp(-1.0f/((absk*L)*(absk*L))) / pow(absk, 4);
+    result *= pow(glm::dot(glm::normalize(k), glm::normalize(w)), 2);
+    return result;
+}
+
+float OceanSimulator::omega(glm::vec2 k)
+{
+    float klen = glm::length(k);
+    return sqrt(g * klen);
+}
+
+glm::vec3 OceanSimulator::slope(float x, float z) const
+{
+    using std::complex;
+    glm::vec3 result(0.0f, 0.0f, 0.0f);
+    for (int n = -N / 2; n < N / 2; ++n) {
+        for (int m = -N / 2; m < N / 2; ++m) {
+            int bufferIndex = (n + N) % N * N + (m + N) % N;
+            glm::vec2 k = kBuffer[bufferIndex];
+            float k_dot_x = glm::dot(glm::vec2(x, z), k);
+
+            complex<float> tmp = hBuffer[bufferIndex]
+                                 * complex<float>(cos(k_dot_x), sin(k_dot_x));
+
+            glm::vec2 v = -tmp.imag() * k;
+            result.x += v.x;
+            result.z += v.y;
+        }
+    }
+    return result;
+}
+
+glm::vec3 OceanSimulator::displacement(float x, float z) const
+{
+    using std::complex;
+    glm::vec3 result(0.0f, 0.0f, 0.0f);
+    for (int n = -N / 2; n < N / 2; ++n) {
+        for (int m = -N / 2; m < N / 2; ++m) {
+            int bufferIndex = (n + N) % N * N + (m + N) % N;
+            glm::vec2 k = kBuffer[bufferIndex];
+            float k_dot_x = glm::dot(glm::vec2(x, z), k);
+
+            complex<float> tmp = hBuffer[bufferIndex]
+                                 * complex<float>(sin(k_dot_x), -cos(k_dot_x));
+
+            glm::vec2 v = (tmp.real()/glm::length(k)) * k;
+            result.x += v.x;
+            result.z += v.y;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,215 @@
+//
+// The ocean simulation without any rendering
+//
+// OceanSimulator owns the initial spectrum, evolves it in time and turns it
+// into spatial fields with the FFT engine. Everything it produces is plain
+// CPU memory, so it runs without a GL context or a display. The Ocean and
+// VertexBufferOcean classes upload what it packs for their renderers.
+//
+
+#ifndef PROJECT_OCEAN_SIMULATOR_H
+#define PROJECT_OCEAN_SIMULATOR_H
+
+// GLM Math Library
+#include <glm/glm.hpp>
+
+#include <complex>
+#include <memory>
+#include <random>
+
+#include "FFT.h"
+#include "Spectrum.h"
+#include "TextureEncoding.h"
+
+// Views of the spatial fields of one frame. The value of a field at grid
+// point (i, j) is field[i * rowStride + j * step].
+struct OceanFields
+{
+    const float *height;
+    const float *slopeX, *slopeZ;
+    const float *dispX, *dispZ;
+    int rowStride;
+    int step;
+};
+
+// Milliseconds the last simulate spent in each of its stages
+struct OceanTimings
+{
+    // Evaluating, mirroring and packing the spectra
+    double spectrum;
+    // The 2D transforms
+    double transform;
+};
+
+// What packTextures saw in the height map
+struct OceanMapStats
+{
+    // Extremes of (-dispX, height, -dispZ)
+    glm::vec3 minimum, maximum;
+    // Texels with a channel outside the range the height format maps to
+    // [0, 1]. Unorm encodings clamp them. Always 0 for RGBA16F.
+    int clipped;
+};
+
+class OceanSimulator
+{
+public:
+    // resolution must be at least 8 and even, with no prime factors other than
+    // 2, 3 and 5. The spectrum of time t is evaluated at
+    // (t + 10000) * timeScale.
+    OceanSimulator(glm::vec2 wind, int resolution, float amplitude, float timeScale);
+    ~OceanSimulator();
+
+    OceanSimulator(const OceanSimulator &) = delete;
+    OceanSimulator &operator=(const OceanSimulator &) = delete;
+
+    // Resolution of the grid
+    int size() const { return N; }
+
+    // Side length of the simulated patch
+    int length() const { return L; }
+
+    // Evaluates the spectrum at time and transforms it to the spatial fields
+    void simulate(float time, FFTMode mode);
+
+    // The fields of the last simulate, valid until the next call
+    OceanFields fields() const;
+
+    const OceanTimings &timings() const { return lastTimings; }
+
+    // Packs the fields as the RGB height and normal maps of Ocean, 3*N*N
+    // floats each. Heights hold (-dispX, height, -dispZ) / 5 + 0.5 and
+    // normals the unit normal / 2 + 0.5.
+    OceanMapStats packTextures(float *heightMap, float *normalMap) const;
+
+    // Packs the same maps in the given formats, N*N texels each. Every row
+    // is encoded and measured in chunks right after they are computed,
+    // while they are still in cache. Throws std::invalid_argument for a
+    // height map of RG16Snorm.
+    OceanMapStats packTextures(const MapFormat &heightFormat, void *heightMap,
+                               const MapFormat &normalFormat, void *normalMap) const;
+
+    // Packs the fields as the vertices and normals of VertexBufferOcean,
+    // 3*N*N floats each, on a grid width wide centered on the origin
+    void packVertices(float *vertices, float *normals, float width) const;
+
+    // Evaluates the whole spectrum at time without transforming it, for the
+    // direct evaluation below
+    void evaluate(float time);
+
+    // Height, slope and displacement at (x, z) summed directly from the
+    // spectrum of the last evaluate. Deprecated, extremely slow.
+    float height(float x, float z) const;
+    glm::vec3 slope(float x, float z) const;
+    glm::vec3 displacement(float x, float z) const;
+
+    // Number of threads simulate and the packing split their work across,
+    // including the calling one. 0 uses one per hardware thread, which is
+    // the default.
+    void setThreadCount(int threads);
+
+    // The pool simulate runs on, for callers that process its fields
+    ThreadPool *threadPool() const { return pool.get(); }
+
+    // Changes the wind and the wave amplitude. The initial spectrum is
+    // recomputed from the same random numbers, so the waves keep their shape.
+    void setParameters(glm::vec2 wind, float amplitude);
+
+    // Replaces the random numbers of the initial spectrum with the ones of
+    // seed. The seed is taken from the clock by default.
+    void setSeed(unsigned seed);
+
+    // Lets simulate advance the wave phases by rotating them when it is
+    // called with times exactly step apart, instead of evaluating sin and cos
+    // for every wave vector. The phases are evaluated directly again after a
+    // number of steps and for any other time. 0 disables it, the default.
+    void setTimeStep(float step);
+
+    // Quantizes every wave frequency down to a multiple of the one of a wave
+    // that turns once per period, so the ocean repeats exactly every period
+    // units of simulate time. Waves slower than that stand still. 0 gives
+    // every wave its own frequency, the default.
+    void setLoopPeriod(float period);
+
+    float loopPeriod() const { return repeatPeriod; }
+
+private:
+    float g;
+    float PI;
+    float timeScale;
+    // Resolution
+    int N;
+    // Water Length
+    int L;
+    // Wave height amplitude parameter
+    float A;
+    // Wind direction and speed in one vector
+    glm::vec2 w;
+    // the buffer to store computed results
+    std::complex<float> *hBuffer;
+    glm::vec2 *kBuffer;
+    std::complex<float> *epsilonBufferx;
+    std::complex<float> *epsilonBuffery;
+    std::complex<float> *displacementBufferx;
+    std::complex<float> *displacementBuffery;
+    // Scratch of the real transforms, allocated once like the buffers above
+    std::complex<float> *scratchBuffer;
+    // FFT plan for N-point transforms, shared by every row and column
+    FFTPlan fft;
+    RealFFTPlan rfft;
+    // Worker threads shared by every phase of simulate
+    std::unique_ptr<ThreadPool> pool;
+    // Seed of the random numbers of the initial spectrum
+    unsigned seed;
+    // Tables of the wave vectors in the first N/2+1 columns, which is all
+    // simulate evaluates as the rest follows from Hermitian symmetry.
+    // The initial spectrum h0(k) and conj(h0(-k)) only changes with the
+    // wind and amplitude, so every frame just rotates its phase.
+    float *h0Real, *h0Imag;
+    float *h0ConjReal, *h0ConjImag;
+    // Frequencies omega(k) and phase rotors exp(i*omega*t) of the last frame
+    float *omegaTable;
+    float *phaseReal, *phaseImag;
+    // k and k/|k| with the Nyquist components zeroed, for the derivatives
+    float *kxTable, *kzTable;
+    float *kxOverK, *kzOverK;
+    // exp(i*omega*dt) of one time step, which advances the phase rotors
+    float *stepReal, *stepImag;
+    float timeStep;
+    // Period the frequencies are quantized to, 0 if they are not
+    float repeatPeriod;
+    // Time the phases were last computed for, and the number of steps they
+    // have been rotated since they were evaluated directly (-1 before that)
+    float phaseTime;
+    int stepsSinceSync;
+    // The mode of the last simulate, which decides the layout of the fields
+    FFTMode lastMode;
+    OceanTimings lastTimings;
+
+    // Evaluates the first N/2+1 columns of every spectrum, rows stride
+    // values apart
+    void updateSpectrum(float time, int stride);
+
+    // Fills the rest of every row from Hermitian symmetry
+    void mirrorSpectrum();
+
+    // Fills the frequency table from the dispersion relation and the period
+    void computeFrequencies();
+
+    // Fills the h0 tables from the current wind and amplitude
+    void computeInitialSpectrum();
+
+    // The tables above in the form the spectrum kernels take them
+    SpectrumTables spectrumTables() const;
+
+    std::complex<float> h0(glm::vec2 k, std::default_random_engine &random);
+
+    inline void normalRandom(std::default_random_engine &random, float &xi1, float &xi2);
+
+    inline float Ph(glm::vec2 k);
+
+    inline float omega(glm::vec2 k);
+};
+
+
+#endif //PROJECT_OCEAN_SIMULATOR_H
@@ -0,0 +1,150 @@
+//
+// Helpers for picking SIMD code paths at runtime and allocating the
+// aligned memory they work on
+//
+// Kernels for wider instruction sets are compiled with OCEAN_TARGET_AVX2 so
+// the rest of the project keeps building for the baseline CPU, and are only
+// called after cpuHasAVX2() confirmed that the running CPU supports them.
+//
+
+#ifndef PROJECT_SIMD_H
+#define PROJECT_SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#define OCEAN_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(OCEAN_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define OCEAN_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#else
+#define OCEAN_TARGET_AVX2
+#endif
+
+// Instruction sets the SIMD kernels are written for
+enum class InstructionSet
+{
+    // Choose the widest one the CPU supports
+    Auto,
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+// True if the CPU supports AVX2, FMA and F16C and the OS saves the AVX
+// registers. Every CPU with AVX2 has F16C, so the AVX2 kernels may use it.
+inline bool cpuHasAVX2()
+{
+#if defined(OCEAN_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+                                  && __builtin_cpu_supports("f16c");
+    return supported;
+#elif defined(OCEAN_SIMD_X86) && defined(_MSC_VER)
+    static const bool supported = [] {
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool fma = (info[2] & (1 << 12)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool f16c = (info[2] & (1 << 29)) != 0;
+        if (!fma || !f16c || !osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+// Resolves Auto to the widest instruction set available, and anything the
+// CPU cannot run to the next narrower one
+inline InstructionSet resolveInstructionSet(InstructionSet isa)
+{
+#if defined(OCEAN_SIMD_X86) && (defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__))
+    if ((isa == InstructionSet::Auto || isa == InstructionSet::AVX2) && cpuHasAVX2())
+        return InstructionSet::AVX2;
+    if (isa == InstructionSet::Scalar)
+        return InstructionSet::Scalar;
+    return InstructionSet::SSE2;
+#else
+    (void)isa;
+    return InstructionSet::Scalar;
+#endif
+}
+
+// Name of an instruction set for logs and benchmark output
+inline const char *instructionSetName(InstructionSet isa)
+{
+    switch (isa) {
+        case InstructionSet::Auto:   return "auto";
+        case InstructionSet::Scalar: return "scalar";
+        case InstructionSet::SSE2:   return "sse2";
+        case InstructionSet::AVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+// Alignment of buffers the kernels stream over: a cache line, which is
+// also enough for the widest vector loads
+const size_t SIMDAlignment = 64;
+
+// Allocates bytes aligned to SIMDAlignment. The memory comes from the
+// global operator new, so it is counted and replaced like any other.
+inline void *allocateAligned(size_t bytes)
+{
+    // The original pointer is kept just in front of the aligned block
+    size_t extra = SIMDAlignment - 1 + sizeof(void *);
+    auto *base = static_cast<char *>(::operator new(bytes + extra));
+    auto address = (uintptr_t)(base + sizeof(void *));
+    auto *aligned = base + sizeof(void *) + (SIMDAlignment - address % SIMDAlignment) % SIMDAlignment;
+    reinterpret_cast<void **>(aligned)[-1] = base;
+    return aligned;
+}
+
+inline void freeAligned(void *p)
+{
+    if (p)
+        ::operator delete(reinterpret_cast<void **>(p)[-1]);
+}
+
+// Aligned, zero-initialized array of count trivial values, such as floats
+// or complex floats. Release it with freeAligned.
+template <typename T>
+T *allocateAlignedArray(size_t count)
+{
+    auto *p = static_cast<T *>(allocateAligned(count * sizeof(T)));
+    for (size_t i = 0; i < count; ++i)
+        new (p + i) T();
+    return p;
+}
+
+// Allocator that keeps the storage of standard containers aligned
+template <typename T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(size_t count) { return static_cast<T *>(allocateAligned(count * sizeof(T))); }
+    void deallocate(T *p, size_t) { freeAligned(p); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+
+#endif //PROJECT_SIMD_H
@@ -0,0 +1,189 @@
+//
+// Time evolution of the ocean spectrum
+//
+
+#include "Spectrum.h"
+
+#include <cmath>
+
+namespace {
+
+const double TwoOverPI = 0.636619772367581343076;
+const double HalfPI = 1.57079632679489661923;
+
+// Splits omega*time into y + quadrant*PI/2 with |y| <= PI/4. The product
+// and the reduction are done in double, the offset ocean times being far
+// too large for a float angle to keep its fraction.
+inline float reduceAngle(float omega, double time, int &quadrant)
+{
+    double x = omega * time;
+    double j = std::nearbyint(x * TwoOverPI);
+    quadrant = (int)(long long)j & 3;
+    return (float)(x - j * HalfPI);
+}
+
+// Minimax polynomials for sin and cos on [-PI/4, PI/4], the ones of the
+// Cephes sinf and cosf
+inline float sinPolynomial(float y, float z)
+{
+    return y + y * z * (-1.6666654611e-1f + z * (8.3321608736e-3f + z * -1.9515295891e-4f));
+}
+
+inline float cosPolynomial(float z)
+{
+    return 1.0f - 0.5f * z + z * z * (4.166664568298827e-2f + z * (-1.388731625493765e-3f
+                                                                   + z * 2.443315711809948e-5f));
+}
+
+void sincosScalar(float omega, double time, float &c, float &s)
+{
+    int quadrant;
+    float y = reduceAngle(omega, time, quadrant);
+    float z = y * y;
+    float sy = sinPolynomial(y, z), cy = cosPolynomial(z);
+    switch (quadrant) {
+        case 0: c = cy;  s = sy;  break;
+        case 1: c = -sy; s = cy;  break;
+        case 2: c = -cy; s = -sy; break;
+        default: c = sy; s = -cy; break;
+    }
+}
+
+// Spectra of wave vector i from its phase rotor (c, s), written to field
+// index j. With H = h0(k)*(c + i*s) + conj(h0(-k))*(c - i*s):
+//   slope        = i*k*H
+//   displacement = -i*k/|k|*H
+void fieldsScalar(const SpectrumTables &t, int i, float c, float s, const SpectrumFields &f, int j)
+{
+    float hr = (t.h0Real[i] + t.h0ConjReal[i]) * c + (t.h0ConjImag[i] - t.h0Imag[i]) * s;
+    float hi = (t.h0Imag[i] + t.h0ConjImag[i]) * c + (t.h0Real[i] - t.h0ConjReal[i]) * s;
+    f.height[j] = std::complex<float>(hr, hi);
+    f.slopeX[j] = std::complex<float>(-t.kx[i] * hi, t.kx[i] * hr);
+    f.slopeZ[j] = std::complex<float>(-t.kz[i] * hi, t.kz[i] * hr);
+    f.dispX[j] = std::complex<float>(t.kxOverK[i] * hi, -t.kxOverK[i] * hr);
+    f.dispZ[j] = std::complex<float>(t.kzOverK[i] * hi, -t.kzOverK[i] * hr);
+}
+
+template <bool Advance>
+void spectrumScalar(const SpectrumTables &t, int first, int begin, int count, double time,
+                    const SpectrumFields &f)
+{
+    for (int j = begin; j < count; ++j) {
+        int i = first + j;
+        float c, s;
+        if (Advance) {
+            c = t.phaseReal[i] * t.stepReal[i] - t.phaseImag[i] * t.stepImag[i];
+            s = t.phaseReal[i] * t.stepImag[i] + t.phaseImag[i] * t.stepReal[i];
+        } else {
+            sincosScalar(t.omega[i], time, c, s);
+        }
+        t.phaseReal[i] = c;
+        t.phaseImag[i] = s;
+        fieldsScalar(t, i, c, s, f, j);
+    }
+}
+
+#ifdef OCEAN_SIMD_X86
+
+// Interleaves eight real and imaginary parts into eight complex values
+OCEAN_TARGET_AVX2 inline void storeComplex(std::complex<float> *out, __m256 re, __m256 im)
+{
+    __m256 lo = _mm256_unpacklo_ps(re, im), hi = _mm256_unpackhi_ps(re, im);
+    auto *p = reinterpret_cast<float *>(out);
+    _mm256_storeu_ps(p, _mm256_permute2f128_ps(lo, hi, 0x20));
+    _mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+
+// Same as spectrumScalar, eight wave vectors at a time
+template <bool Advance>
+OCEAN_TARGET_AVX2 void spectrumAVX2(const SpectrumTables &t, int first, int count, double time,
+                                    const SpectrumFields &f)
+{
+    const __m256d vtime = _mm256_set1_pd(time);
+    const __m256d twoOverPi = _mm256_set1_pd(TwoOverPI), halfPi = _mm256_set1_pd(HalfPI);
+    const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2);
+    int j = 0;
+    for (; j + 8 <= count; j += 8) {
+        int i = first + j;
+        __m256 c, s;
+        if (Advance) {
+            __m256 pr = _mm256_loadu_ps(t.phaseReal + i), pi = _mm256_loadu_ps(t.phaseImag + i);
+            __m256 sr = _mm256_loadu_ps(t.stepReal + i), si = _mm256_loadu_ps(t.stepImag + i);
+            c = _mm256_fmsub_ps(pr, sr, _mm256_mul_ps(pi, si));
+            s = _mm256_fmadd_ps(pr, si, _mm256_mul_ps(pi, sr));
+        } else {
+            // Reduce in double, four angles per register
+            __m256 omega = _mm256_loadu_ps(t.omega + i);
+            __m256d x0 = _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(omega)), vtime);
+            __m256d x1 = _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(omega, 1)), vtime);
+            __m256d j0 = _mm256_round_pd(_mm256_mul_pd(x0, twoOverPi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            __m256d j1 = _mm256_round_pd(_mm256_mul_pd(x1, twoOverPi), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            __m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_fnmadd_pd(j0, halfPi, x0))),
+                                            _mm256_cvtpd_ps(_mm256_fnmadd_pd(j1, halfPi, x1)), 1);
+            __m256i quadrant = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm256_cvtpd_epi32(j0)),
+                                                       _mm256_cvtpd_epi32(j1), 1);
+
+            __m256 z = _mm256_mul_ps(y, y);
+            __m256 sy = _mm256_fmadd_ps(z, _mm256_set1_ps(-1.9515295891e-4f), _mm256_set1_ps(8.3321608736e-3f));
+            sy = _mm256_fmadd_ps(z, sy, _mm256_set1_ps(-1.6666654611e-1f));
+            sy = _mm256_fmadd_ps(_mm256_mul_ps(y, z), sy, y);
+            __m256 cy = _mm256_fmadd_ps(z, _mm256_set1_ps(2.443315711809948e-5f), _mm256_set1_ps(-1.388731625493765e-3f));
+            cy = _mm256_fmadd_ps(z, cy, _mm256_set1_ps(4.166664568298827e-2f));
+            cy = _mm256_fmadd_ps(_mm256_mul_ps(z, z), cy, _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, _mm256_set1_ps(1.0f)));
+
+            // Odd quadrants swap sin and cos, sin is negative in quadrants
+            // 2 and 3 and cos in quadrants 1 and 2
+            __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, one), one));
+            __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, two), 30));
+            __m256 cosSign = _mm256_castsi256_ps(
+                    _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, one), two), 30));
+            c = _mm256_xor_ps(_mm256_blendv_ps(cy, sy, swap), cosSign);
+            s = _mm256_xor_ps(_mm256_blendv_ps(sy, cy, swap), sinSign);
+        }
+        _mm256_storeu_ps(t.phaseReal + i, c);
+        _mm256_storeu_ps(t.phaseImag + i, s);
+
+        __m256 h0r = _mm256_loadu_ps(t.h0Real + i), h0i = _mm256_loadu_ps(t.h0Imag + i);
+        __m256 hcr = _mm256_loadu_ps(t.h0ConjReal + i), hci = _mm256_loadu_ps(t.h0ConjImag + i);
+        __m256 hr = _mm256_fmadd_ps(_mm256_add_ps(h0r, hcr), c, _mm256_mul_ps(_mm256_sub_ps(hci, h0i), s));
+        __m256 hi = _mm256_fmadd_ps(_mm256_add_ps(h0i, hci), c, _mm256_mul_ps(_mm256_sub_ps(h0r, hcr), s));
+        __m256 nhr = _mm256_sub_ps(_mm256_setzero_ps(), hr), nhi = _mm256_sub_ps(_mm256_setzero_ps(), hi);
+        __m256 kx = _mm256_loadu_ps(t.kx + i), kz = _mm256_loadu_ps(t.kz + i);
+        __m256 kxk = _mm256_loadu_ps(t.kxOverK + i), kzk = _mm256_loadu_ps(t.kzOverK + i);
+        storeComplex(f.height + j, hr, hi);
+        storeComplex(f.slopeX + j, _mm256_mul_ps(kx, nhi), _mm256_mul_ps(kx, hr));
+        storeComplex(f.slopeZ + j, _mm256_mul_ps(kz, nhi), _mm256_mul_ps(kz, hr));
+        storeComplex(f.dispX + j, _mm256_mul_ps(kxk, hi), _mm256_mul_ps(kxk, nhr));
+        storeComplex(f.dispZ + j, _mm256_mul_ps(kzk, hi), _mm256_mul_ps(kzk, nhr));
+    }
+    spectrumScalar<Advance>(t, first, j, count, time, f);
+}
+
+#endif
+
+template <bool Advance>
+void spectrum(const SpectrumTables &tables, int first, int count, double time,
+              const SpectrumFields &fields, InstructionSet isa)
+{
+#ifdef OCEAN_SIMD_X86
+    if (resolveInstructionSet(isa) == InstructionSet::AVX2) {
+        spectrumAVX2<Advance>(tables, first, count, time, fields);
+        return;
+    }
+#endif
+    spectrumScalar<Advance>(tables, first, 0, count, time, fields);
+}
+
+}
+
+void evaluateSpectrum(const SpectrumTables &tables, int first, int count, double time,
+                      const SpectrumFields &fields, InstructionSet isa)
+{
+    spectrum<false>(tables, first, count, time, fields, isa);
+}
+
+void advanceSpectrum(const SpectrumTables &tables, int first, int count,
+                     const SpectrumFields &fields, InstructionSet isa)
+{
+    spectrum<true>(tables, first, count, 0.0, fields, isa);
+}
@@ -0,0 +1,60 @@
+//
+// Time evolution of the ocean spectrum
+//
+// Every frame turns the initial spectrum h0(k) into the five spectra the
+// ocean transforms: height, the two slopes and the two displacements. The
+// kernels below do this for a run of wave vectors in one pass over
+// separate real and imaginary tables, eight wave vectors at a time with
+// AVX2.
+//
+
+#ifndef PROJECT_SPECTRUM_H
+#define PROJECT_SPECTRUM_H
+
+#include <complex>
+
+#include "SIMD.h"
+
+// Per wave vector tables, all indexed the same way
+struct SpectrumTables
+{
+    // h0(k) and conj(h0(-k))
+    const float *h0Real, *h0Imag;
+    const float *h0ConjReal, *h0ConjImag;
+    // Angular frequency omega(k)
+    const float *omega;
+    // Components of k the slopes are taken along, and the same divided
+    // by |k| for the displacements. Both are 0 where no derivative exists.
+    const float *kx, *kz;
+    const float *kxOverK, *kzOverK;
+    // exp(i*omega*dt) of one time step
+    const float *stepReal, *stepImag;
+    // The phase rotors exp(i*omega*t), updated by the kernels
+    float *phaseReal, *phaseImag;
+};
+
+// Where the kernels write the spectra of the wave vectors they evaluate
+struct SpectrumFields
+{
+    std::complex<float> *height;
+    std::complex<float> *slopeX, *slopeZ;
+    std::complex<float> *dispX, *dispZ;
+};
+
+// Largest error of the phase rotors evaluateSpectrum computes, compared
+// with std::cos and std::sin of the exact angle
+const float SpectrumPhaseError = 2e-7f;
+
+// Evaluates count wave vectors starting at table index first at the given
+// time, and writes their spectra to fields[0..count). The angles are
+// reduced in double precision, so large times keep their accuracy.
+void evaluateSpectrum(const SpectrumTables &tables, int first, int count, double time,
+                      const SpectrumFields &fields, InstructionSet isa);
+
+// Same as evaluateSpectrum, but advances the phase rotors by one time step
+// instead of evaluating them, so no sin or cos is computed
+void advanceSpectrum(const SpectrumTables &tables, int first, int count,
+                     const SpectrumFields &fields, InstructionSet isa);
+
+
+#endif //PROJECT_SPECTRUM_H
@@ -0,0 +1,283 @@
+//
+// Texel formats of the ocean height and normal maps
+//
+
+#include "TextureEncoding.h"
+#include "Half.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+// Alpha of 1 in both packed formats
+const uint16_t HalfOne = 0x3c00;
+const uint32_t PackedAlpha = 3u << 30;
+
+inline int16_t snorm16(float value)
+{
+    return (int16_t)std::lrint(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f);
+}
+
+inline uint32_t unorm10(float value)
+{
+    return (uint32_t)std::lrint(std::min(std::max(value, 0.0f), 1.0f) * 1023.0f);
+}
+
+void encodeScalar(MapEncoding encoding, const float *x, const float *y, const float *z,
+                  int begin, int count, void *out)
+{
+    switch (encoding) {
+        case MapEncoding::RGB32F: {
+            auto *texels = static_cast<float *>(out);
+            for (int j = begin; j < count; ++j) {
+                texels[3 * j + 0] = x[j];
+                texels[3 * j + 1] = y[j];
+                texels[3 * j + 2] = z[j];
+            }
+            break;
+        }
+        case MapEncoding::RGBA16F: {
+            auto *texels = static_cast<uint16_t *>(out);
+            for (int j = begin; j < count; ++j) {
+                texels[4 * j + 0] = floatToHalf(x[j]);
+                texels[4 * j + 1] = floatToHalf(y[j]);
+                texels[4 * j + 2] = floatToHalf(z[j]);
+                texels[4 * j + 3] = HalfOne;
+            }
+            break;
+        }
+        case MapEncoding::RG16Snorm: {
+            auto *texels = static_cast<int16_t *>(out);
+            for (int j = begin; j < count; ++j) {
+                texels[2 * j + 0] = snorm16(x[j]);
+                texels[2 * j + 1] = snorm16(z[j]);
+            }
+            break;
+        }
+        case MapEncoding::RGB10A2: {
+            auto *texels = static_cast<uint32_t *>(out);
+            for (int j = begin; j < count; ++j)
+                texels[j] = unorm10(x[j]) | unorm10(y[j]) << 10 | unorm10(z[j]) << 20 | PackedAlpha;
+            break;
+        }
+    }
+}
+
+void measureScalar(const float *x, const float *y, const float *z, int begin, int count, TexelRange &range)
+{
+    const float *planes[3] = {x, y, z};
+    for (int j = begin; j < count; ++j) {
+        bool outside = false;
+        for (int c = 0; c < 3; ++c) {
+            float value = planes[c][j];
+            range.minimum[c] = std::min(range.minimum[c], value);
+            range.maximum[c] = std::max(range.maximum[c], value);
+            outside = outside || value < 0.0f || value > 1.0f;
+        }
+        range.outside += outside;
+    }
+}
+
+#ifdef OCEAN_SIMD_X86
+
+// Same as encodeScalar, eight texels at a time. The conversions round to
+// nearest even like the scalar ones, so both give the same texels.
+OCEAN_TARGET_AVX2 void encodeAVX2(MapEncoding encoding, const float *x, const float *y, const float *z,
+                                  int count, void *out)
+{
+    int j = 0;
+    switch (encoding) {
+        case MapEncoding::RGB32F:
+            break;
+        case MapEncoding::RGBA16F: {
+            auto *texels = static_cast<__m128i *>(out);
+            const __m128i one = _mm_set1_epi16((short)HalfOne);
+            for (; j + 8 <= count; j += 8) {
+                __m128i hx = _mm256_cvtps_ph(_mm256_loadu_ps(x + j), _MM_FROUND_TO_NEAREST_INT);
+                __m128i hy = _mm256_cvtps_ph(_mm256_loadu_ps(y + j), _MM_FROUND_TO_NEAREST_INT);
+                __m128i hz = _mm256_cvtps_ph(_mm256_loadu_ps(z + j), _MM_FROUND_TO_NEAREST_INT);
+                // Interleave to x y z 1, two texels per 32 bit lane pair
+                __m128i xy0 = _mm_unpacklo_epi16(hx, hy), xy1 = _mm_unpackhi_epi16(hx, hy);
+                __m128i zw0 = _mm_unpacklo_epi16(hz, one), zw1 = _mm_unpackhi_epi16(hz, one);
+                _mm_storeu_si128(texels + j / 2 + 0, _mm_unpacklo_epi32(xy0, zw0));
+                _mm_storeu_si128(texels + j / 2 + 1, _mm_unpackhi_epi32(xy0, zw0));
+                _mm_storeu_si128(texels + j / 2 + 2, _mm_unpacklo_epi32(xy1, zw1));
+                _mm_storeu_si128(texels + j / 2 + 3, _mm_unpackhi_epi32(xy1, zw1));
+            }
+            break;
+        }
+        case MapEncoding::RG16Snorm: {
+            auto *texels = static_cast<__m128i *>(out);
+            const __m256 lo = _mm256_set1_ps(-1.0f), hi = _mm256_set1_ps(1.0f), max = _mm256_set1_ps(32767.0f);
+            for (; j + 8 <= count; j += 8) {
+                __m256 vx = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(x + j), lo), hi);
+                __m256 vz = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(z + j), lo), hi);
+                __m256i ix = _mm256_cvtps_epi32(_mm256_mul_ps(vx, max));
+                __m256i iz = _mm256_cvtps_epi32(_mm256_mul_ps(vz, max));
+                __m128i sx = _mm_packs_epi32(_mm256_castsi256_si128(ix), _mm256_extracti128_si256(ix, 1));
+                __m128i sz = _mm_packs_epi32(_mm256_castsi256_si128(iz), _mm256_extracti128_si256(iz, 1));
+                _mm_storeu_si128(texels + j / 4 + 0, _mm_unpacklo_epi16(sx, sz));
+                _mm_storeu_si128(texels + j / 4 + 1, _mm_unpackhi_epi16(sx, sz));
+            }
+            break;
+        }
+        case MapEncoding::RGB10A2: {
+            auto *texels = static_cast<uint32_t *>(out);
+            const __m256 lo = _mm256_setzero_ps(), hi = _mm256_set1_ps(1.0f), max = _mm256_set1_ps(1023.0f);
+            const __m256i alpha = _mm256_set1_epi32((int)PackedAlpha);
+            for (; j + 8 <= count; j += 8) {
+                __m256 vx = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(x + j), lo), hi);
+                __m256 vy = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(y + j), lo), hi);
+                __m256 vz = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(z + j), lo), hi);
+                __m256i r = _mm256_cvtps_epi32(_mm256_mul_ps(vx, max));
+                __m256i g = _mm256_slli_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(vy, max)), 10);
+                __m256i b = _mm256_slli_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(vz, max)), 20);
+                __m256i texel = _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, alpha));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(texels + j), texel);
+            }
+            break;
+        }
+    }
+    encodeScalar(encoding, x, y, z, j, count, out);
+}
+
+// Same as measureScalar, eight texels at a time
+OCEAN_TARGET_AVX2 void measureAVX2(const float *x, const float *y, const float *z, int count, TexelRange &range)
+{
+    const float *planes[3] = {x, y, z};
+    __m256 minimum[3], maximum[3];
+    for (int c = 0; c < 3; ++c) {
+        minimum[c] = _mm256_set1_ps(range.minimum[c]);
+        maximum[c] = _mm256_set1_ps(range.maximum[c]);
+    }
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+    int j = 0;
+    for (; j + 8 <= count; j += 8) {
+        __m256 outside = zero;
+        for (int c = 0; c < 3; ++c) {
+            __m256 value = _mm256_loadu_ps(planes[c] + j);
+            // A NaN value keeps the running extreme, as in the scalar loop
+            minimum[c] = _mm256_min_ps(value, minimum[c]);
+            maximum[c] = _mm256_max_ps(value, maximum[c]);
+            outside = _mm256_or_ps(outside, _mm256_or_ps(_mm256_cmp_ps(value, zero, _CMP_LT_OQ),
+                                                         _mm256_cmp_ps(value, one, _CMP_GT_OQ)));
+        }
+        for (int mask = _mm256_movemask_ps(outside); mask; mask &= mask - 1)
+            ++range.outside;
+    }
+    for (int c = 0; c < 3; ++c) {
+        alignas(32) float lanes[16];
+        _mm256_store_ps(lanes, minimum[c]);
+        _mm256_store_ps(lanes + 8, maximum[c]);
+        for (int k = 0; k < 8; ++k) {
+            range.minimum[c] = std::min(range.minimum[c], lanes[k]);
+            range.maximum[c] = std::max(range.maximum[c], lanes[8 + k]);
+        }
+    }
+    measureScalar(x, y, z, j, count, range);
+}
+
+#endif
+
+}
+
+size_t mapTexelSize(MapEncoding encoding)
+{
+    switch (encoding) {
+        case MapEncoding::RGB32F:    return 3 * sizeof(float);
+        case MapEncoding::RGBA16F:   return 4 * sizeof(uint16_t);
+        case MapEncoding::RG16Snorm: return 2 * sizeof(int16_t);
+        case MapEncoding::RGB10A2:   return sizeof(uint32_t);
+    }
+    return 0;
+}
+
+const char *mapEncodingName(MapEncoding encoding)
+{
+    switch (encoding) {
+        case MapEncoding::RGB32F:    return "rgb32f";
+        case MapEncoding::RGBA16F:   return "rgba16f";
+        case MapEncoding::RG16Snorm: return "rg16snorm";
+        case MapEncoding::RGB10A2:   return "rgb10a2";
+    }
+    return "unknown";
+}
+
+MapFormat heightMapFormat(MapEncoding encoding, float range)
+{
+    if (encoding == MapEncoding::RG16Snorm)
+        throw std::invalid_argument("heightMapFormat: RG16Snorm only stores normals");
+    if (!(range > 0.0f))
+        throw std::invalid_argument("heightMapFormat: range must be positive");
+    if (encoding == MapEncoding::RGBA16F)
+        return {encoding, 1.0f, 0.0f};
+    return {encoding, 0.5f / range, 0.5f};
+}
+
+MapFormat normalMapFormat(MapEncoding encoding)
+{
+    if (encoding == MapEncoding::RGBA16F || encoding == MapEncoding::RG16Snorm)
+        return {encoding, 1.0f, 0.0f};
+    return {encoding, 0.5f, 0.5f};
+}
+
+void encodeTexels(MapEncoding encoding, const float *x, const float *y, const float *z, int count,
+                  void *out, InstructionSet isa)
+{
+#ifdef OCEAN_SIMD_X86
+    if (resolveInstructionSet(isa) == InstructionSet::AVX2) {
+        encodeAVX2(encoding, x, y, z, count, out);
+        return;
+    }
+#endif
+    encodeScalar(encoding, x, y, z, 0, count, out);
+}
+
+void measureTexels(const float *x, const float *y, const float *z, int count, TexelRange &range,
+                   InstructionSet isa)
+{
+#ifdef OCEAN_SIMD_X86
+    if (resolveInstructionSet(isa) == InstructionSet::AVX2) {
+        measureAVX2(x, y, z, count, range);
+        return;
+    }
+#endif
+    measureScalar(x, y, z, 0, count, range);
+}
+
+void decodeTexel(MapEncoding encoding, const void *map, size_t index, float &x, float &y, float &z)
+{
+    switch (encoding) {
+        case MapEncoding::RGB32F: {
+            auto *texel = static_cast<const float *>(map) + 3 * index;
+            x = texel[0];
+            y = texel[1];
+            z = texel[2];
+            break;
+        }
+        case MapEncoding::RGBA16F: {
+            auto *texel = static_cast<const uint16_t *>(map) + 4 * index;
+            x = halfToFloat(texel[0]);
+            y = halfToFloat(texel[1]);
+            z = halfToFloat(texel[2]);
+            break;
+        }
+        case MapEncoding::RG16Snorm: {
+            auto *texel = static_cast<const int16_t *>(map) + 2 * index;
+            x = std::max(texel[0] / 32767.0f, -1.0f);
+            y = 0.0f;
+            z = std::max(texel[1] / 32767.0f, -1.0f);
+            break;
+        }
+        case MapEncoding::RGB10A2: {
+            uint32_t texel = static_cast<const uint32_t *>(map)[index];
+            x = (texel & 0x3ff) / 1023.0f;
+            y = (texel >> 10 & 0x3ff) / 1023.0f;
+            z = (texel >> 20 & 0x3ff) / 1023.0f;
+            break;
+        }
+    }
+}
@@ -0,0 +1,96 @@
+//
+// Texel formats of the ocean height and normal maps
+//
+// The maps default to three floats per texel, which is more precision than
+// the renderer needs and three times the upload of the packed formats
+// below. Texels store value * scale + bias of the simulated values, and the
+// shaders undo it with the decode scale and bias of the map format.
+//
+
+#ifndef PROJECT_TEXTURE_ENCODING_H
+#define PROJECT_TEXTURE_ENCODING_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+
+#include "SIMD.h"
+
+enum class MapEncoding
+{
+    // Three floats, 12 bytes per texel
+    RGB32F,
+    // Three halves and an alpha of 1, 8 bytes per texel
+    RGBA16F,
+    // x and z of a unit normal as snorm16, 4 bytes per texel. The shader
+    // reconstructs y as sqrt(1 - x^2 - z^2), so only normal maps can use it.
+    RG16Snorm,
+    // Three 10 bit unorm channels and 2 bits of alpha in a little endian
+    // uint32, red lowest, 4 bytes per texel
+    RGB10A2,
+};
+
+// How the values of a map are stored
+struct MapFormat
+{
+    MapEncoding encoding;
+    // A texel holds value * scale + bias
+    float scale;
+    float bias;
+
+    // The value of a texel is texel * decodeScale() + decodeBias()
+    float decodeScale() const { return 1.0f / scale; }
+    float decodeBias() const { return -bias / scale; }
+};
+
+// Bytes of every texel of encoding
+size_t mapTexelSize(MapEncoding encoding);
+
+// Name of an encoding for logs and command lines
+const char *mapEncodingName(MapEncoding encoding);
+
+// The format of a height map of displacements and heights in [-range, range].
+// Halves store them as they are, the other encodings map the range to
+// [0, 1], which for RGB32F and the default range are the original maps.
+// Throws std::invalid_argument for RG16Snorm.
+MapFormat heightMapFormat(MapEncoding encoding, float range = 2.5f);
+
+// The format of a normal map of unit normals
+MapFormat normalMapFormat(MapEncoding encoding);
+
+// Writes count texels of the given encoding to out, from three planes of
+// values that already had the scale and bias of the format applied. y is
+// not read for RG16Snorm. Unorm and snorm values are clamped to their range.
+void encodeTexels(MapEncoding encoding, const float *x, const float *y, const float *z, int count,
+                  void *out, InstructionSet isa);
+
+// Extremes of the values of a run of texels, channel by channel
+struct TexelRange
+{
+    float minimum[3] = {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(),
+                        std::numeric_limits<float>::infinity()};
+    float maximum[3] = {-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+                        -std::numeric_limits<float>::infinity()};
+    // Texels with a channel outside [0, 1], which unorm encodings clamp
+    int outside = 0;
+
+    void merge(const TexelRange &other)
+    {
+        for (int c = 0; c < 3; ++c) {
+            minimum[c] = std::min(minimum[c], other.minimum[c]);
+            maximum[c] = std::max(maximum[c], other.maximum[c]);
+        }
+        outside += other.outside;
+    }
+};
+
+// Adds count texels of three planes of values to range
+void measureTexels(const float *x, const float *y, const float *z, int count, TexelRange &range,
+                   InstructionSet isa);
+
+// Reads texel index of a map of the given encoding back into the encoded
+// values, the inverse of encodeTexels. y is 0 for RG16Snorm.
+void decodeTexel(MapEncoding encoding, const void *map, size_t index, float &x, float &y, float &z);
+
+
+#endif //PROJECT_TEXTURE_ENCODING_H
@@ -0,0 +1,78 @@
+//
+// A persistent pool of worker threads for data-parallel loops
+//
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threads)
+        : task(nullptr), context(nullptr), count(0), generation(0), pending(0), stopping(false)
+{
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    threadCount = threads > 0 ? threads : 1;
+
+    // The calling thread takes range 0 of every job
+    for (int i = 1; i < threadCount; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::run(int count, Task task, void *context)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = task;
+        this->context = context;
+        this->count = count;
+        pending = threadCount - 1;
+        ++generation;
+    }
+    jobReady.notify_all();
+
+    runRange(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this] { return pending == 0; });
+}
+
+void ThreadPool::workerLoop(int index)
+{
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobReady.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        runRange(index);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            last = --pending == 0;
+        }
+        if (last)
+            jobDone.notify_one();
+    }
+}
+
+void ThreadPool::runRange(int index) const
+{
+    int begin, end;
+    partitionRange(count, threadCount, index, begin, end);
+    if (begin < end)
+        task(context, begin, end);
+}
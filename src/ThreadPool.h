@@ -0,0 +1,81 @@
+//
+// A persistent pool of worker threads for data-parallel loops
+//
+// Threads are created once and sleep between jobs, so a frame can split
+// several short phases across cores without paying for thread creation.
+// Work is partitioned statically: the same count and thread count always
+// give every thread the same contiguous range.
+//
+
+#ifndef PROJECT_THREADPOOL_H
+#define PROJECT_THREADPOOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // threads is the number of threads sharing each job, including the
+    // calling thread. 0 uses one per hardware thread.
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const { return threadCount; }
+
+    // Splits [0, count) into one contiguous range per thread and calls
+    // f(begin, end) for each range, on the calling thread and the workers.
+    // Returns once every range is done. Jobs must not be nested.
+    template <typename F>
+    void parallelFor(int count, F &&f)
+    {
+        if (count <= 0)
+            return;
+        if (threadCount == 1 || count == 1) {
+            f(0, count);
+            return;
+        }
+        typedef typename std::remove_reference<F>::type Function;
+        run(count, [](void *context, int begin, int end) {
+            (*static_cast<Function *>(context))(begin, end);
+        }, (void *)&f);
+    }
+
+private:
+    typedef void (*Task)(void *context, int begin, int end);
+
+    int threadCount;
+    std::vector<std::thread> workers;
+
+    // The current job, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    Task task;
+    void *context;
+    int count;
+    // Incremented for every job so sleeping workers can tell a new one
+    unsigned long generation;
+    int pending;
+    bool stopping;
+
+    void run(int count, Task task, void *context);
+    void workerLoop(int index);
+    void runRange(int index) const;
+};
+
+// Range of [0, count) that thread index of threads works on
+inline void partitionRange(int count, int threads, int index, int &begin, int &end)
+{
+    begin = (int)((long long)count * index / threads);
+    end = (int)((long long)count * (index + 1) / threads);
+}
+
+
+#endif //PROJECT_THREADPOOL_H
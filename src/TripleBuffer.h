@@ -0,0 +1,60 @@
+//
+// Lock-free hand-off of the latest value between two threads
+//
+// A writer and a reader share three slots. The writer fills its back slot
+// and publishes it by swapping it with the middle one; the reader takes the
+// middle slot by swapping it with its front one, if a newer one was
+// published since. Neither ever waits for the other, and a value the reader
+// has not taken yet is simply replaced by the next one.
+//
+
+#ifndef PROJECT_TRIPLE_BUFFER_H
+#define PROJECT_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+class TripleBuffer
+{
+public:
+    TripleBuffer() : back(0), middle(1), front(2) {}
+
+    TripleBuffer(const TripleBuffer &) = delete;
+    TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+    // The slot the writer may fill, which the reader never touches
+    int writeSlot() const { return back; }
+
+    // Hands the filled back slot to the reader and gives the writer another
+    void publish()
+    {
+        back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & SlotMask;
+    }
+
+    // Takes the last published slot if there is a new one. Returns whether
+    // the read slot changed.
+    bool acquire()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & Fresh))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & SlotMask;
+        return true;
+    }
+
+    // The slot the reader may read, which the writer never touches
+    int readSlot() const { return front; }
+
+private:
+    // Set in middle when it holds a slot the reader has not taken
+    static const int Fresh = 4;
+    static const int SlotMask = 3;
+
+    // Padded apart, as they are written by different threads
+    int back;
+    char backPadding[64 - sizeof(int)];
+    std::atomic<int> middle;
+    char middlePadding[64 - sizeof(std::atomic<int>)];
+    int front;
+};
+
+
+#endif //PROJECT_TRIPLE_BUFFER_H
@@ -13,18 +13,36 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include <complex>
+#include "OceanSimulator.h"
 
 
+/*
+ * An ocean drawn as a vertex buffer. The waves are simulated by
+ * OceanSimulator and packed into vertices and normals on the CPU.
+ */
 class VertexBufferOcean
 {
 public:
+    // resolution must be at least 8 and even, with no prime factors other than
+    // 2, 3 and 5
     VertexBufferOcean(glm::vec2 wind, int resolution, float amplitude);
     ~VertexBufferOcean();
 
     // Given current time, generate wave
     void generateWave(float time);
 
+    // Number of threads generateWave splits its work across, including the
+    // calling one. 0 uses one per hardware thread, which is the default.
+    void setThreadCount(int threads);
+
+    // Changes the wind and the wave amplitude. The initial spectrum is
+    // recomputed from the same random numbers, so the waves keep their shape.
+    void setParameters(glm::vec2 wind, float amplitude);
+
+    // Lets generateWave advance the wave phases by rotating them when it is
+    // called with times exactly step apart. See OceanSimulator::setTimeStep.
+    void setTimeStep(float step);
+
     // The 3*N*N array to store final vertices position
     int vertexCount;
     float *vertices;
@@ -35,9 +53,10 @@ public:
     float *normals;
     // The flag to control generating method
     bool useFFT;
+    // How the spectra are transformed when useFFT is set (Complex, Real or
+    // Packed), Real by default
+    FFTMode fftMode;
 private:
-    float g;
-    float PI;
     float unitWidth;
     // Choppiness of the wave
     float choppy;
@@ -45,36 +64,8 @@ private:
     int N;
     // Water Length
     int L;
-    // Wave height amplitude parameter
-    float A;
-    // Wind direction and speed in one vector
-    glm::vec2 w;
-    // the buffer to store computed results
-    std::complex<float> *hBuffer;
-    glm::vec2 *kBuffer;
-    std::complex<float> *epsilonBufferx;
-    std::complex<float> *epsilonBuffery;
-    std::complex<float> *displacementBufferx;
-    std::complex<float> *displacementBuffery;
-
-    // Returns height
-    float H(float x, float z, float t);
-
-    std::complex<float> h(glm::vec2 k, float t);
-
-    std::complex<float> h0(glm::vec2 k);
-
-    inline float normalRandom();
-
-    inline float Ph(glm::vec2 k);
-
-    inline float omega(glm::vec2 k);
-
-    glm::vec3 epsilon(float x, float z, float t);
-
-    // Returns displacement vector
-    glm::vec3 D(float x, float z, float t);
+    OceanSimulator simulator;
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -37,6 +37,8 @@ void mouseCallback(GLFWwindow *window, double xpos, double ypos);
 void scrollCallback(GLFWwindow *window, double offsetX, double offsetY);
 // Render xyz coordinate in world space
 void renderCoordinates(const glm::mat4 &view, const glm::mat4 &proj);
+// Prints where generateWave spent its time since the last report
+void printTimingReport(Ocean &ocean, bool async);
 
 
 // **********GLFW window related attributes**********
@@ -49,8 +51,31 @@ float gLastFrame = 0.0f;
 Camera gCamera;
 bool gDrawNormals = false;
 bool gPause = false;
-
-int main()
+// Play a precomputed loop instead of simulating every frame
+bool gLoop = false;
+// Fit the height map range to the waves
+bool gAutoRange = false;
+// Simulate on a thread of its own
+bool gAsync = true;
+// Upload the maps through pixel buffers
+bool gStreaming = false;
+// Simulate at SimulationRate and blend frames in between
+bool gFixedRate = false;
+const float SimulationRate = 20.0f;
+// Index into MapEncodingPresets of the texture formats of the maps
+int gMapEncoding = 0;
+
+// Height and normal map formats the M key cycles through
+const MapEncoding MapEncodingPresets[][2] = {
+        {MapEncoding::RGB32F, MapEncoding::RGB32F},
+        {MapEncoding::RGBA16F, MapEncoding::RGBA16F},
+        {MapEncoding::RGBA16F, MapEncoding::RG16Snorm},
+        {MapEncoding::RGB10A2, MapEncoding::RGB10A2},
+};
+const int MapEncodingPresetCount = sizeof(MapEncodingPresets) / sizeof(MapEncodingPresets[0]);
+
+// An optional argument names a baked animation to play instead of simulating
+int main(int argc, char **argv)
 {
     GLFWwindow *window = init();
     if (window == nullptr) {
@@ -101,6 +126,16 @@ int main()
     gCamera.MovementSpeed = 5.0f;
 
     Ocean ocean(glm::vec2(0.2f, 2.0f), 128, 0.05f);
+    ocean.setAsyncSimulation(gAsync);
+    if (argc > 1) {
+        // Simulate instead of giving up on a file that cannot be played.
+        // The ocean still owns GL objects, so the context has to outlive it.
+        try {
+            ocean.playBaked(argv[1]);
+        } catch (const std::exception &e) {
+            std::cout << e.what() << ", simulating instead" << std::endl;
+        }
+    }
     ocean.generateWave((float)glfwGetTime());
     glm::vec3 deepWaterColorSunset = glm::vec3(powf(0.14f, 2.2f),
                                          powf(0.15f, 2.2f),
@@ -133,6 +168,38 @@ int main()
         processInput(window);
 
         // Update wave data
+        static bool looping = false;
+        if (gLoop != looping) {
+            // A 20 second loop of 240 frames
+            ocean.setLoop(gLoop ? 20.0f : 0.0f, 240);
+            looping = gLoop;
+        }
+        static bool autoRange = false;
+        if (gAutoRange != autoRange) {
+            ocean.setAutoRange(gAutoRange);
+            autoRange = gAutoRange;
+        }
+        static bool async = gAsync;
+        if (gAsync != async) {
+            printTimingReport(ocean, async);
+            ocean.setAsyncSimulation(gAsync);
+            async = gAsync;
+        }
+        static bool streaming = false;
+        if (gStreaming != streaming) {
+            ocean.setStreamingUpload(gStreaming);
+            streaming = gStreaming;
+        }
+        static bool fixedRate = false;
+        if (gFixedRate != fixedRate) {
+            ocean.setSimulationRate(gFixedRate ? SimulationRate : 0.0f);
+            fixedRate = gFixedRate;
+        }
+        static int mapEncoding = 0;
+        if (gMapEncoding != mapEncoding) {
+            ocean.setMapEncodings(MapEncodingPresets[gMapEncoding][0], MapEncodingPresets[gMapEncoding][1]);
+            mapEncoding = gMapEncoding;
+        }
         if (!gPause) {
             ocean.generateWave((float) glfwGetTime());
         }
@@ -164,12 +231,19 @@ int main()
         shader.setInt("heightMap", 0);
         shader.setInt("normalMap", 1);
         shader.setInt("skybox", 2);
+        shader.setInt("nextHeightMap", 3);
+        shader.setInt("nextNormalMap", 4);
+        ocean.setDecodeUniforms(shader);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, ocean.heightMap);
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, ocean.normalMap);
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_CUBE_MAP, skybox.getCubeMap());
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, ocean.nextHeightMap);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, ocean.nextNormalMap);
         glBindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, ocean.indexCount, GL_UNSIGNED_INT, nullptr);
 
@@ -181,10 +255,17 @@ int main()
             normalShader.setMat4("model", glm::mat4(1.0f));
             normalShader.setInt("heightMap", 0);
             normalShader.setInt("normalMap", 1);
+            normalShader.setInt("nextHeightMap", 3);
+            normalShader.setInt("nextNormalMap", 4);
+            ocean.setDecodeUniforms(normalShader);
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, ocean.heightMap);
             glActiveTexture(GL_TEXTURE1);
             glBindTexture(GL_TEXTURE_2D, ocean.normalMap);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, ocean.nextHeightMap);
+            glActiveTexture(GL_TEXTURE4);
+            glBindTexture(GL_TEXTURE_2D, ocean.nextNormalMap);
             glBindVertexArray(VAO);
             glDrawElements(GL_TRIANGLES, ocean.indexCount, GL_UNSIGNED_INT, nullptr);
         }
@@ -213,16 +294,61 @@ int main()
         textRenderer.renderText(textShader, "Press P to pause or resume",
                                 0.0f, 50.0f, 0.3f,
                                 glm::vec3(0.0, 1.0f, 1.0f));
+        textRenderer.renderText(textShader, std::string("Press M to switch map formats: ")
+                                            + mapEncodingName(MapEncodingPresets[gMapEncoding][0]) + " / "
+                                            + mapEncodingName(MapEncodingPresets[gMapEncoding][1]),
+                                0.0f, 66.0f, 0.3f,
+                                glm::vec3(0.0, 1.0f, 1.0f));
+        const OceanMapStats &stats = ocean.mapStats();
+        textRenderer.renderText(textShader, "Press R to fit the height range (" + std::string(gAutoRange ? "on" : "off")
+                                            + "), heights " + std::to_string(stats.minimum.y) + " to "
+                                            + std::to_string(stats.maximum.y) + ", clipped "
+                                            + std::to_string(stats.clipped),
+                                0.0f, 82.0f, 0.3f,
+                                glm::vec3(0.0, 1.0f, 1.0f));
+        textRenderer.renderText(textShader, "Press U to switch uploads (" + std::string(gStreaming ? "pixel buffers" : "direct")
+                                            + "), " + std::to_string(ocean.uploadTime()) + " ms",
+                                0.0f, 98.0f, 0.3f,
+                                glm::vec3(0.0, 1.0f, 1.0f));
+        const OceanTimingReport &report = ocean.timingReport();
+        textRenderer.renderText(textShader, "Press T to switch simulation threads (" + std::string(gAsync ? "async" : "sync")
+                                            + "), wave " + std::to_string(report.wave.mean()) + " ms, jitter "
+                                            + std::to_string(report.wave.jitter()) + " ms",
+                                0.0f, 114.0f, 0.3f,
+                                glm::vec3(0.0, 1.0f, 1.0f));
+        textRenderer.renderText(textShader, "Press F to switch simulation rate ("
+                                            + (gFixedRate ? std::to_string((int)SimulationRate) + " Hz, blended"
+                                                          : std::string("every frame")) + ")",
+                                0.0f, 130.0f, 0.3f,
+                                glm::vec3(0.0, 1.0f, 1.0f));
         // Rendering Ends here
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    printTimingReport(ocean, gAsync);
     glfwTerminate();
     return 0;
 }
 
+void printTimingReport(Ocean &ocean, bool async)
+{
+    const OceanTimingReport &report = ocean.timingReport();
+    auto line = [](const char *name, const TimingStats &stats) {
+        std::cout << "  " << name << ": mean " << stats.mean() << " ms, jitter " << stats.jitter()
+                  << " ms, worst " << stats.worst << " ms" << std::endl;
+    };
+    std::cout << (async ? "Async" : "Sync") << " simulation, " << report.wave.count << " frames" << std::endl;
+    line("generateWave on the render thread", report.wave);
+    line("simulation and packing", report.simulation);
+    if (async) {
+        line("request to packed frame", report.latency);
+        std::cout << "  frames without a new wave: " << report.staleFrames << std::endl;
+    }
+    ocean.resetTimingReport();
+}
+
 GLFWwindow *init()
 {
     // Initialization of GLFW context
@@ -318,6 +444,42 @@ void processInput(GLFWwindow *window)
         gPause = !gPause;
         lastPressedTime = glfwGetTime();
     }
+
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS
+        && glfwGetTime() - lastPressedTime > 0.2) {
+        gLoop = !gLoop;
+        lastPressedTime = glfwGetTime();
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS
+        && glfwGetTime() - lastPressedTime > 0.2) {
+        gAutoRange = !gAutoRange;
+        lastPressedTime = glfwGetTime();
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS
+        && glfwGetTime() - lastPressedTime > 0.2) {
+        gAsync = !gAsync;
+        lastPressedTime = glfwGetTime();
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS
+        && glfwGetTime() - lastPressedTime > 0.2) {
+        gStreaming = !gStreaming;
+        lastPressedTime = glfwGetTime();
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS
+        && glfwGetTime() - lastPressedTime > 0.2) {
+        gFixedRate = !gFixedRate;
+        lastPressedTime = glfwGetTime();
+    }
+
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS
+        && glfwGetTime() - lastPressedTime > 0.2) {
+        gMapEncoding = (gMapEncoding + 1) % MapEncodingPresetCount;
+        lastPressedTime = glfwGetTime();
+    }
 }
 
 void mouseCallback(GLFWwindow *window, double xpos, double ypos)